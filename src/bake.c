@@ -0,0 +1,446 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+/* Expected values computed by the prototype while the test is
+   generated.  Small ranges are expanded to literal cases first, then
+   all the cases with literal arguments are passed in batches to the
+   python workers of the prototypes, and every case which gives a
+   number or a plain string becomes a case with the expected value.
+   Such cases are checked without the prototype.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <err.h>
+
+#include "pipo.h"
+#include "global.h"
+#include "types.h"
+#include "codegen.h"
+#include "oracle.h"
+#include "cache.h"
+#include "bake.h"
+
+/* Ranges of a case are expanded only if they give at most this
+   number of cases.  */
+#define BAKE_RANGE_CASES 1024
+
+/* Cases of a function passed to a prototype worker at once, unless
+   their arguments take more than BAKE_BATCH_SIZE bytes.  */
+#define BAKE_BATCH 256
+#define BAKE_BATCH_SIZE (1 << 16)
+
+/* Number of values of the range T, or -1 if its bounds are not
+   integers.  The distance between the bounds is computed unsigned,
+   as it may not fit in a signed integer.  */
+static long long
+bake_range_count (tree t)
+{
+  unsigned long long n;
+  long long v[3];
+  char *end;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    {
+      v[i] = strtoll (TREE_VALUE (TREE_OPERAND (t, i)), &end, 0);
+      if (*end != '\0')
+	return -1;
+    }
+  if (v[1] < v[0])
+    return 0;
+  n = ((unsigned long long) v[1] - (unsigned long long) v[0])
+      / (unsigned long long) v[2];
+  return n >= LLONG_MAX ? LLONG_MAX : (long long) n + 1;
+}
+
+/* Append to the list CASES the literal cases of the values of the
+   arguments starting from the element EL.  VALUES are the arguments
+   chosen so far, N is their number.  */
+static void
+bake_expand (tree cases, struct tree_list_element *el, const char **values,
+	     int n)
+{
+  unsigned long long start, step;
+  long long k, count;
+  char buf[32];
+  tree t;
+  int i;
+
+  if (el == NULL)
+    {
+      t = make_tree_list ();
+      for (i = 0; i < n; i++)
+	tree_list_append (t, make_value_str (values[i]));
+      tree_list_append (cases, t);
+      return;
+    }
+
+  if (TREE_CODE (el->entry) == VALUE)
+    {
+      values[n] = TREE_VALUE (el->entry);
+      bake_expand (cases, el->next, values, n + 1);
+      return;
+    }
+
+  /* The values are counted rather than stepped past the end, which
+     may overflow.  */
+  start = strtoll (TREE_VALUE (TREE_OPERAND (el->entry, 0)), NULL, 0);
+  step = strtoll (TREE_VALUE (TREE_OPERAND (el->entry, 2)), NULL, 0);
+  count = bake_range_count (el->entry);
+  for (k = 0; k < count; k++)
+    {
+      snprintf (buf, sizeof (buf), "%lld", (long long) (start + k * step));
+      values[n] = buf;
+      bake_expand (cases, el->next, values, n + 1);
+    }
+}
+
+/* Replace the cases of FUNCTION whose arguments are literals and
+   small ranges by the literal cases of all the values.  */
+static void
+bake_ranges (tree function)
+{
+  struct tree_list_element *el, *al;
+  tree cases = make_tree_list (), old = TREE_OPERAND (function, 1);
+  const char **values;
+  long long n, count;
+  int nargs, ranges;
+
+  DL_FOREACH (TREE_LIST (old), el)
+    {
+      count = 1;
+      nargs = ranges = 0;
+      if (TREE_CODE (el->entry) == LIST)
+	DL_FOREACH (TREE_LIST (el->entry), al)
+	  {
+	    nargs++;
+	    if (TREE_CODE (al->entry) == RANGE
+		&& (n = bake_range_count (al->entry)) >= 0)
+	      count *= n, ranges++;
+	    else if (TREE_CODE (al->entry) != VALUE)
+	      count = -1;
+	    if (count < 0 || count > BAKE_RANGE_CASES)
+	      break;
+	  }
+      if (TREE_CODE (el->entry) != LIST || al != NULL || ranges == 0)
+	{
+	  tree_list_append (cases, el->entry);
+	  continue;
+	}
+
+      if ((values = malloc (nargs * sizeof (char *))) == NULL)
+	err (EXIT_FAILURE, "malloc failed");
+      bake_expand (cases, TREE_LIST (el->entry), values, 0);
+      free (values);
+      free_tree (el->entry);
+    }
+  free_list (old);
+  TREE_OPERAND_SET (function, 1, cases);
+}
+
+/* Check if the cases of FUNCTION can be baked: the prototype must
+   return a value which the library returns the same way.  */
+static bool
+bake_function_p (tree function)
+{
+  tree sig = TREE_OPERAND (function, 2);
+  enum type_code code;
+
+  if (sig == NULL)
+    return true;
+  code = type_lookup (TREE_VALUE (TREE_LIST (sig)->entry));
+  return TYPE_IS_NUMBER (code) || code == TYPE_STR;
+}
+
+/* Class of the result type of FUNCTION for the oracle and its size in
+   bits in *BITS: `i', `u', `f' or `s' for signed, unsigned, real and
+   string types, or `-' if the function has no signature.  */
+static char
+bake_kind (tree function, int *bits)
+{
+  tree sig = TREE_OPERAND (function, 2);
+  enum type_code code;
+
+  *bits = 0;
+  if (sig == NULL)
+    return '-';
+  code = type_lookup (TREE_VALUE (TREE_LIST (sig)->entry));
+  *bits = 8 * TYPE_SIZE (code);
+  switch (TYPE_CLASS (code))
+    {
+    case type_signed: return 'i';
+    case type_unsigned: return 'u';
+    case type_real: return 'f';
+    default: return 's';
+    }
+}
+
+/* Check if the case T has literal arguments only.  */
+static bool
+bake_case_p (tree t)
+{
+  struct tree_list_element *el;
+
+  if (TREE_CODE (t) != LIST || TREE_LIST (t) == NULL)
+    return false;
+  DL_FOREACH (TREE_LIST (t), el)
+    if (TREE_CODE (el->entry) != VALUE)
+      return false;
+  return true;
+}
+
+/* Cases of a function from FIRST to LAST, not included, and the
+   request for the N cases ASKED of them with literal arguments which
+   are not in the cache, with their KEYS.  */
+struct bake_span
+{
+  tree module, function;
+  struct tree_list_element *first, *last;
+  struct tree_list_element **asked;
+  struct cache_key *keys;
+  int n;
+};
+
+/* Spans of all the cases and their batches, and the function called
+   with every span once its expected values are computed.  The cases
+   are looked up in CACHE if the SOURCE of the current module is
+   KEYED.  */
+struct bake_plan
+{
+  struct bake_span *spans;
+  struct oracle_batch *batches;
+  size_t n, size;
+  bake_ready ready;
+  void *data;
+  struct cache *cache;
+  uint64_t source;
+  bool keyed;
+  int cases, baked, cached;
+};
+
+/* Make the case of the element EL a case with the expected value
+   VALUE computed by the prototype, unless it is `-'.  */
+static void
+bake_result (struct bake_plan *plan, struct tree_list_element *el,
+	     const char *value)
+{
+  tree t;
+
+  if (strcmp (value, "-") == 0)
+    return;
+  t = make_tree (EXPECT);
+  TREE_LOCATION (t) = TREE_LOCATION (el->entry);
+  TREE_OPERAND_SET (t, 0, el->entry);
+  TREE_OPERAND_SET (t, 1, make_value_str (value));
+  el->entry = t;
+  plan->baked++;
+}
+
+/* Append to PLAN the spans of the cases of FUNCTION of MODULE.  A
+   function without cases has one empty span.  */
+static void
+bake_spans (struct bake_plan *plan, tree module, tree function)
+{
+  struct tree_list_element *el = TREE_LIST (TREE_OPERAND (function, 1));
+  const char *name = TREE_VALUE (TREE_OPERAND (function, 0));
+  bool baked = bake_function_p (function);
+  bool vectorized = function_attribute_p (function, "vectorized");
+  int bits;
+  char kind = bake_kind (function, &bits);
+  struct bake_span *span;
+  struct cache_key key;
+  char *buf, *args, value[64];
+  size_t size, len;
+  FILE *f;
+
+  do
+    {
+      if (plan->n == plan->size)
+	{
+	  plan->size = plan->size == 0 ? 64 : plan->size * 2;
+	  plan->spans = realloc (plan->spans,
+				 plan->size * sizeof (struct bake_span));
+	  plan->batches = realloc (plan->batches,
+				   plan->size * sizeof (struct oracle_batch));
+	  if (plan->spans == NULL || plan->batches == NULL)
+	    err (EXIT_FAILURE, "realloc failed");
+	}
+      span = &plan->spans[plan->n];
+      memset (span, 0, sizeof (struct bake_span));
+      memset (&plan->batches[plan->n++], 0, sizeof (struct oracle_batch));
+      span->module = module;
+      span->function = function;
+      span->first = el;
+
+      if ((f = open_memstream (&buf, &size)) == NULL)
+	err (EXIT_FAILURE, "open_memstream failed");
+      for (; el != NULL && span->n < BAKE_BATCH
+	     && ftell (f) < BAKE_BATCH_SIZE; el = el->next)
+	{
+	  FILE *a;
+
+	  if (!baked || !bake_case_p (el->entry))
+	    continue;
+	  if ((a = open_memstream (&args, &len)) == NULL)
+	    err (EXIT_FAILURE, "open_memstream failed");
+	  fprintf (a, "(");
+	  codegen_atomic_value (a, el->entry, NULL, false);
+	  fprintf (a, TREE_LIST (el->entry)->next == NULL ? ",)" : ")");
+	  fclose (a);
+	  plan->cases++;
+
+	  /* A key of zero is not cached.  */
+	  memset (&key, 0, sizeof (key));
+	  if (plan->keyed)
+	    {
+	      cache_key (&key, plan->source, name, kind, bits, vectorized,
+			 args, len);
+	      if (cache_get (plan->cache, &key, value, sizeof (value)))
+		{
+		  bake_result (plan, el, value);
+		  plan->cached++;
+		  free (args);
+		  continue;
+		}
+	    }
+
+	  if (span->asked == NULL
+	      && ((span->asked = malloc (BAKE_BATCH
+					 * sizeof (struct tree_list_element *)))
+		  == NULL
+		  || (span->keys = malloc (BAKE_BATCH
+					   * sizeof (struct cache_key)))
+		     == NULL))
+	    err (EXIT_FAILURE, "malloc failed");
+	  span->asked[span->n] = el;
+	  span->keys[span->n++] = key;
+	  fprintf (f, "%s,\n", args);
+	  free (args);
+	}
+      fclose (f);
+      span->last = el;
+
+      if (span->n != 0
+	  && -1 == asprintf (&plan->batches[plan->n - 1].request,
+			     "%s.%s %i %i %c %i\n%s",
+			     TREE_VALUE (TREE_OPERAND (module, 0)), name,
+			     vectorized, span->n, kind, bits, buf))
+	err (EXIT_FAILURE, "asprintf failed");
+      if (span->n != 0)
+	plan->batches[plan->n - 1].size
+	  = strlen (plan->batches[plan->n - 1].request);
+      free (buf);
+    }
+  while (el != NULL);
+}
+
+/* Turn the cases of the span I of the plan DATA into cases with the
+   expected values computed by the prototype, and pass the span on.
+   The cases of a batch without a result are not baked, and the
+   values of the others are added to the cache.  A case which cannot
+   be baked is not, so that every case found in the cache is baked.  */
+static void
+bake_apply (size_t i, void *data)
+{
+  struct bake_plan *plan = (struct bake_plan *) data;
+  struct bake_span *span = &plan->spans[i];
+  char *line = plan->batches[i].result, *end;
+  int j;
+
+  for (j = 0; j < span->n && line != NULL; j++)
+    {
+      if ((end = strchr (line, '\n')) == NULL)
+	break;
+      *end = '\0';
+      if (plan->cache != NULL && span->keys[j].h1 != 0
+	  && strcmp (line, "-") != 0)
+	cache_put (plan->cache, &span->keys[j], line);
+      bake_result (plan, span->asked[j], line);
+      line = end + 1;
+    }
+
+  if (plan->ready != NULL)
+    plan->ready (span->module, span->function, span->first, span->last,
+		 plan->data);
+}
+
+/* Compute the expected values of the cases of the modules MODULES
+   by the prototypes, evaluated by JOBS workers or by one per
+   processor if JOBS is 0.  Values found in the cache are not
+   computed again, and no worker is started if all of them are.
+   Unless READY is NULL, it is called with DATA and the cases of every
+   function in the order of the modules, a span at a time, as soon as
+   their expected values are computed.  Returns non-zero on error.  */
+int
+bake (tree modules, int jobs, bake_ready ready, void *data)
+{
+  struct tree_list_element *tl, *tll;
+  struct bake_plan plan;
+  struct oracle *o;
+  size_t i, asked = 0;
+  int ret = 0;
+
+  memset (&plan, 0, sizeof (plan));
+  plan.ready = ready;
+  plan.data = data;
+  plan.cache = cache_open ();
+  DL_FOREACH (TREE_LIST (modules), tl)
+    {
+      plan.keyed = plan.cache != NULL
+		   && cache_source (TREE_VALUE (TREE_OPERAND (tl->entry, 0)),
+				    &plan.source);
+      DL_FOREACH (TREE_LIST (TREE_OPERAND (tl->entry, 1)), tll)
+	{
+	  if (bake_function_p (tll->entry))
+	    bake_ranges (tll->entry);
+	  bake_spans (&plan, tl->entry, tll->entry);
+	}
+    }
+
+  for (i = 0; i < plan.n; i++)
+    asked += plan.spans[i].n;
+  if (asked == 0)
+    for (i = 0; i < plan.n; i++)
+      bake_apply (i, &plan);
+  else if ((o = oracle_open (modules, jobs)) == NULL)
+    ret = 1;
+  else
+    {
+      ret = oracle_eval (o, plan.batches, plan.n, bake_apply, &plan);
+      ret |= oracle_close (o);
+    }
+  if (ret != 0)
+    fprintf (stderr, "error: prototypes failed while computing expected "
+	     "values\n");
+  else
+    printf ("note: %i of %i cases are baked.\n", plan.baked, plan.cases);
+  if (ret == 0 && plan.cached != 0)
+    printf ("note: %i cases are found in the cache.\n", plan.cached);
+
+  for (i = 0; i < plan.n; i++)
+    {
+      free (plan.batches[i].request);
+      free (plan.batches[i].result);
+      free (plan.spans[i].asked);
+      free (plan.spans[i].keys);
+    }
+  free (plan.batches);
+  free (plan.spans);
+  if (plan.cache != NULL)
+    cache_close (plan.cache);
+  return ret;
+}
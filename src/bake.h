@@ -0,0 +1,29 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+
+#ifndef __BAKE_H__
+#define __BAKE_H__
+
+#include "tree.h"
+
+/* Called with the cases of a function from the first element to the
+   last one, not included, once their expected values are computed.  */
+typedef void (*bake_ready) (tree, tree, struct tree_list_element *,
+			    struct tree_list_element *, void *);
+
+int bake (tree, int, bake_ready, void *);
+
+#endif /* __BAKE_H__ */
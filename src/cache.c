@@ -0,0 +1,256 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+/* Cache of the expected values computed by the prototypes, shared by
+   all the runs in a directory.  A value is found by the hash of the
+   source of the prototype module, the function and its arguments, so
+   it is computed again only if one of them changes.  Modules imported
+   by the prototype are not part of the key.
+
+   The cache is a file mapped by every process using it, holding an
+   open addressing table of fixed slots.  A slot is claimed by setting
+   its first hash atomically, then the value is written and published
+   by setting its length.  A slot which is not published yet is
+   skipped, so processes read and insert values concurrently without
+   locks.  Values which do not fit in a slot are not cached, and the
+   cache does not grow once the slots near a key are taken.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#define CACHE_MAGIC 0x31656863616f7070ULL
+#define CACHE_SLOTS (1 << 18)
+#define CACHE_PROBES 64
+#define CACHE_VALUE 44
+
+struct cache_slot
+{
+  uint64_t h1, h2;
+  uint32_t len;
+  char value[CACHE_VALUE];
+};
+
+struct cache_header
+{
+  uint64_t magic, slots;
+  char pad[sizeof (struct cache_slot) - 2 * sizeof (uint64_t)];
+};
+
+struct cache
+{
+  struct cache_header *header;
+  struct cache_slot *slots;
+  size_t size;
+};
+
+/* Open the cache named by PIPO_CACHE environment variable,
+   `.pipo-cache' by default, creating it if needed.  Returns NULL if
+   the variable is empty or the cache cannot be used.  */
+struct cache *
+cache_open (void)
+{
+  const char *path = getenv ("PIPO_CACHE");
+  size_t size = sizeof (struct cache_header)
+		+ CACHE_SLOTS * sizeof (struct cache_slot);
+  uint64_t magic = 0;
+  struct cache *c;
+  struct stat st;
+  void *mem;
+  int fd;
+
+  if (path == NULL)
+    path = ".pipo-cache";
+  if (*path == '\0')
+    return NULL;
+
+  if ((fd = open (path, O_RDWR | O_CREAT, 0644)) == -1
+      || fstat (fd, &st) == -1
+      || (st.st_size == 0 && ftruncate (fd, size) == -1))
+    {
+      warn ("cannot open cache `%s'", path);
+      if (fd != -1)
+	close (fd);
+      return NULL;
+    }
+  if (st.st_size != 0 && (size_t) st.st_size != size)
+    {
+      fprintf (stderr, "warning: cache `%s' has another layout, not "
+	       "used\n", path);
+      close (fd);
+      return NULL;
+    }
+  mem = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (mem == MAP_FAILED)
+    {
+      warn ("cannot map cache `%s'", path);
+      return NULL;
+    }
+
+  if ((c = malloc (sizeof (struct cache))) == NULL)
+    err (EXIT_FAILURE, "malloc failed");
+  c->header = (struct cache_header *) mem;
+  c->slots = (struct cache_slot *) (c->header + 1);
+  c->size = size;
+  if (!__atomic_compare_exchange_n (&c->header->magic, &magic, CACHE_MAGIC,
+				    false, __ATOMIC_ACQ_REL,
+				    __ATOMIC_ACQUIRE)
+      && magic != CACHE_MAGIC)
+    {
+      fprintf (stderr, "warning: `%s' is not a cache, not used\n", path);
+      cache_close (c);
+      return NULL;
+    }
+  c->header->slots = CACHE_SLOTS;
+  return c;
+}
+
+void
+cache_close (struct cache *c)
+{
+  munmap (c->header, c->size);
+  free (c);
+}
+
+/* Add N bytes of DATA to the hashes of K.  */
+static void
+cache_hash (struct cache_key *k, const void *data, size_t n)
+{
+  const unsigned char *p = (const unsigned char *) data;
+
+  /* FNV-1a with two different offsets.  */
+  while (n-- > 0)
+    {
+      k->h1 = (k->h1 ^ *p) * 1099511628211ULL;
+      k->h2 = (k->h2 ^ *p++) * 1099511628211ULL;
+    }
+}
+
+/* Hash the source `<module>.py' of the prototype MODULE into H.
+   Returns false if it cannot be read.  */
+bool
+cache_source (const char *module, uint64_t *h)
+{
+  struct cache_key k = { 14695981039346656037ULL, 0 };
+  char *path = NULL, buf[4096];
+  size_t n;
+  FILE *f;
+
+  if (-1 == asprintf (&path, "%s.py", module))
+    err (EXIT_FAILURE, "asprintf failed");
+  f = fopen (path, "r");
+  free (path);
+  if (f == NULL)
+    return false;
+  while ((n = fread (buf, 1, sizeof (buf), f)) > 0)
+    cache_hash (&k, buf, n);
+  fclose (f);
+  *h = k.h1;
+  return true;
+}
+
+/* Compute in K the key of the case with the arguments ARGS of LEN
+   bytes of the function FUNCTION of the module with the source hash
+   SOURCE, returning the class KIND of BITS bits and called VECTORIZED
+   or not.  */
+void
+cache_key (struct cache_key *k, uint64_t source, const char *function,
+	   char kind, int bits, bool vectorized, const char *args,
+	   size_t len)
+{
+  k->h1 = 14695981039346656037ULL;
+  k->h2 = 0x9e3779b97f4a7c15ULL;
+  cache_hash (k, &source, sizeof (source));
+  cache_hash (k, function, strlen (function) + 1);
+  cache_hash (k, &kind, sizeof (kind));
+  cache_hash (k, &bits, sizeof (bits));
+  cache_hash (k, &vectorized, sizeof (vectorized));
+  cache_hash (k, args, len);
+
+  /* The second hash is mixed, so that the two do not collide
+     together.  A free slot has the first one zero.  */
+  k->h2 ^= k->h2 >> 33;
+  k->h2 *= 0xff51afd7ed558ccdULL;
+  k->h2 ^= k->h2 >> 33;
+  if (k->h1 == 0)
+    k->h1 = 1;
+}
+
+/* Copy the value of the key K to BUF of SIZE bytes.  Returns false if
+   it is not in the cache C.  */
+bool
+cache_get (struct cache *c, const struct cache_key *k, char *buf,
+	   size_t size)
+{
+  struct cache_slot *s;
+  uint32_t len;
+  int i;
+
+  for (i = 0; i < CACHE_PROBES; i++)
+    {
+      s = &c->slots[(k->h1 + i) % CACHE_SLOTS];
+      if (__atomic_load_n (&s->h1, __ATOMIC_ACQUIRE) == 0)
+	return false;
+      if (s->h1 != k->h1
+	  || (len = __atomic_load_n (&s->len, __ATOMIC_ACQUIRE)) == 0
+	  || s->h2 != k->h2)
+	continue;
+      if (len > size)
+	return false;
+      memcpy (buf, s->value, len - 1);
+      buf[len - 1] = '\0';
+      return true;
+    }
+  return false;
+}
+
+/* Store the value VALUE of the key K in the cache C, unless it is
+   too long or there is no free slot for it.  */
+void
+cache_put (struct cache *c, const struct cache_key *k, const char *value)
+{
+  size_t len = strlen (value);
+  struct cache_slot *s;
+  uint64_t h1;
+  int i;
+
+  if (len > CACHE_VALUE)
+    return;
+  for (i = 0; i < CACHE_PROBES; i++)
+    {
+      s = &c->slots[(k->h1 + i) % CACHE_SLOTS];
+      h1 = 0;
+      if (__atomic_compare_exchange_n (&s->h1, &h1, k->h1, false,
+				       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+	  s->h2 = k->h2;
+	  memcpy (s->value, value, len);
+	  __atomic_store_n (&s->len, len + 1, __ATOMIC_RELEASE);
+	  return;
+	}
+      /* The key is being stored or already is.  */
+      if (h1 == k->h1 && (__atomic_load_n (&s->len, __ATOMIC_ACQUIRE) == 0
+			  || s->h2 == k->h2))
+	return;
+    }
+}
@@ -0,0 +1,40 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pipo.h"
+
+/* Key of an expected value: two independent hashes of the source of
+   the prototype module, the function and its arguments.  */
+struct cache_key
+{
+  uint64_t h1, h2;
+};
+
+struct cache;
+
+struct cache *cache_open (void);
+void cache_close (struct cache *);
+bool cache_source (const char *, uint64_t *);
+void cache_key (struct cache_key *, uint64_t, const char *, char, int, bool,
+		const char *, size_t);
+bool cache_get (struct cache *, const struct cache_key *, char *, size_t);
+void cache_put (struct cache *, const struct cache_key *, const char *);
+
+#endif /* __CACHE_H__ */
@@ -13,82 +13,1601 @@
    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
 
 #include <stdio.h>
+#include <stdint.h>
 #include <err.h>
+#include <unistd.h>
 
 #include "pipo.h"
 #include "tree.h"
 #include "global.h"
+#include "types.h"
 #include "codegen.h"
+#include "shard.h"
+#include "output.h"
+#include "dedup.h"
+#include "config.h"
 
+/* Flags of dlopen used to load the libraries, taken from PIPO_RTLD
+   environment variable.  By default all the symbols are bound when a
+   library is loaded.  */
+static const char *rtld_helpers =
+"_pipo_rtld = 0\n"
+"for flag in os.environ.get('PIPO_RTLD', 'now').split(','):\n"
+"\t_pipo_rtld |= getattr(os, 'RTLD_' + flag.strip().upper())\n";
+
+/* Time of every test and the number of calls it made are appended
+   to the file named by PIPO_TIMES environment variable, to balance
+   the shards of the next run.  */
+static const char *time_helpers =
+"def _pipo_time(name, started, calls):\n"
+"\tpath = os.environ.get('PIPO_TIMES')\n"
+"\tif path:\n"
+"\t\twith open(path, 'a') as f:\n"
+"\t\t\tf.write('%s %f %d\\n' % (name, time.perf_counter() - started, "
+"calls))\n";
+
+/* Python helpers to produce random arguments.  Philox4x32-10
+   counter-based generator is used: a value is a function of the
+   seed, the argument position and the index of the case only, so
+   any case can be recomputed independently from the others.  */
+static const char *random_helpers =
+"def _pipo_philox(seed, index, stream):\n"
+"\tk0, k1 = seed & 0xffffffff, seed >> 32 & 0xffffffff\n"
+"\tc0, c1, c2, c3 = index & 0xffffffff, index >> 32 & 0xffffffff, stream, 0\n"
+"\tfor _ in range(10):\n"
+"\t\tp0 = 0xD2511F53 * c0\n"
+"\t\tp1 = 0xCD9E8D57 * c2\n"
+"\t\tc0, c1, c2, c3 = (p1 >> 32 ^ c1 ^ k0, p1 & 0xffffffff,\n"
+"\t\t\t\t  p0 >> 32 ^ c3 ^ k1, p0 & 0xffffffff)\n"
+"\t\tk0 = k0 + 0x9E3779B9 & 0xffffffff\n"
+"\t\tk1 = k1 + 0xBB67AE85 & 0xffffffff\n"
+"\treturn c0, c1, c2, c3\n"
+"def _pipo_random(seed, stream, index, lo, hi, real, dist):\n"
+"\tw0, w1, w2, w3 = _pipo_philox(seed, index, stream)\n"
+"\tf = ((w0 | w1 << 32) >> 11) * 2.0 ** -53\n"
+"\tif dist == 'edge' and w2 & 3 == 0:\n"
+"\t\tif real:\n"
+"\t\t\tedges = [lo, hi] + [0.0] * (lo <= 0 <= hi)\n"
+"\t\telse:\n"
+"\t\t\tedges = [lo, min(lo + 1, hi), max(hi - 1, lo), hi]\n"
+"\t\t\tedges += [v for v in (-1, 0, 1) if lo <= v <= hi]\n"
+"\t\tx = edges[w3 % len(edges)]\n"
+"\telif real and dist == 'loguniform':\n"
+"\t\tx = lo * (hi / lo) ** f\n"
+"\telif real:\n"
+"\t\tx = lo + (hi - lo) * f\n"
+"\telif dist == 'loguniform' and (lo >= 0 or hi > 0 and w2 >> 2 & 1):\n"
+"\t\tbase = max(lo, 0)\n"
+"\t\tx = base + int(float(hi - base + 1) ** f) - 1\n"
+"\telif dist == 'loguniform':\n"
+"\t\tbase = min(hi, 0)\n"
+"\t\tx = base - int(float(base - lo + 1) ** f) + 1\n"
+"\telse:\n"
+"\t\tx = lo + (w0 | w1 << 32) % (hi - lo + 1)\n"
+"\treturn c_float(x).value if real == 4 else x\n"
+"def _pipo_indices(count):\n"
+"\tcase = os.environ.get('PIPO_CASE')\n"
+"\tif case is not None:\n"
+"\t\treturn range(int(case), min(int(case) + 1, count))\n"
+"\tshard = os.environ.get('PIPO_SHARD')\n"
+"\tif shard is not None:\n"
+"\t\tk, n = map(int, shard.split('/'))\n"
+"\t\treturn range(k, count, n)\n"
+"\treturn range(count)\n"
+"class _PipoReplay(object):\n"
+"\tdef __init__(self, index, args):\n"
+"\t\tself.index, self.args = index, args\n"
+"\tdef __str__(self):\n"
+"\t\treturn 'case %d, arguments %r (replay with PIPO_CASE=%d)' % (\n"
+"\t\t\tself.index, self.args, self.index)\n";
+
+/* Python helpers to stream cases from files.  Files are read by
+   blocks in a background thread while the previous block is being
+   tested, at most two blocks are kept in memory.  Lines of a CSV
+   file are passed to the reader as it asks for them, so a quoted
+   field may span lines; comments and blank lines are skipped only
+   between records.  */
+static const char *file_helpers =
+"class _PipoPrefetch(object):\n"
+"\tdef __init__(self, path, size=1 << 20):\n"
+"\t\tself.queue = queue.Queue(1)\n"
+"\t\tthread = threading.Thread(target=self.read, args=(path, size))\n"
+"\t\tthread.daemon = True\n"
+"\t\tthread.start()\n"
+"\tdef read(self, path, size):\n"
+"\t\ttry:\n"
+"\t\t\twith open(path, 'rb') as f:\n"
+"\t\t\t\tblock = f.read(size)\n"
+"\t\t\t\twhile block:\n"
+"\t\t\t\t\tself.queue.put(block)\n"
+"\t\t\t\t\tblock = f.read(size)\n"
+"\t\t\tself.queue.put(None)\n"
+"\t\texcept Exception as e:\n"
+"\t\t\tself.queue.put(e)\n"
+"\tdef __iter__(self):\n"
+"\t\twhile True:\n"
+"\t\t\tblock = self.queue.get()\n"
+"\t\t\tif isinstance(block, Exception):\n"
+"\t\t\t\traise block\n"
+"\t\t\tif block is None:\n"
+"\t\t\t\treturn\n"
+"\t\t\tyield block\n"
+"def _pipo_csv_value(v):\n"
+"\tfor conv in (int, float):\n"
+"\t\ttry:\n"
+"\t\t\treturn conv(v)\n"
+"\t\texcept ValueError:\n"
+"\t\t\tpass\n"
+"\treturn int(v, 0) if v[:2] in ('0x', '0X') else v\n"
+"def _pipo_csv_lines(path, start):\n"
+"\ttail = b''\n"
+"\tfor block in _PipoPrefetch(path):\n"
+"\t\tlines = (tail + block).split(b'\\n')\n"
+"\t\ttail = lines.pop()\n"
+"\t\tfor l in lines:\n"
+"\t\t\tif not start[0] or (l.strip() and not l.startswith(b'#')):\n"
+"\t\t\t\tstart[0] = False\n"
+"\t\t\t\tyield l.decode() + '\\n'\n"
+"\tif not start[0] or (tail.strip() and not tail.startswith(b'#')):\n"
+"\t\tyield tail.decode()\n"
+"def _pipo_csv(path):\n"
+"\tstart = [True]\n"
+"\tfor row in csv.reader(_pipo_csv_lines(path, start)):\n"
+"\t\tstart[0] = True\n"
+"\t\tyield tuple(_pipo_csv_value(v.strip()) for v in row)\n"
+"def _pipo_records(path, fmt):\n"
+"\trecord = struct.Struct(fmt)\n"
+"\ttail = b''\n"
+"\tfor block in _PipoPrefetch(path):\n"
+"\t\tdata = tail + block if tail else block\n"
+"\t\tn = len(data) - len(data) % record.size\n"
+"\t\tfor r in record.iter_unpack(memoryview(data)[:n]):\n"
+"\t\t\tyield r\n"
+"\t\ttail = data[n:]\n"
+"\tif tail:\n"
+"\t\traise ValueError('%s: truncated record' % path)\n";
+
+/* Python helpers to pass tuples read at run time to the library.
+   Values are converted using the struct format of the records,
+   or by their python type if the format is unknown.  */
+static const char *record_helpers =
+"_pipo_formats = {'b': c_int8, 'B': c_uint8, 'h': c_int16, 'H': c_uint16,\n"
+"\t\t 'i': c_int32, 'I': c_uint32, 'l': c_long, 'L': c_ulong,\n"
+"\t\t 'q': c_int64, 'Q': c_uint64, 'n': c_ssize_t, 'N': c_size_t,\n"
+"\t\t 'f': c_float, 'd': c_double, '?': c_bool}\n"
+"def _pipo_fields(fmt):\n"
+"\tfields, count = [], ''\n"
+"\tfor ch in fmt.lstrip('@=<>!'):\n"
+"\t\tif ch.isdigit():\n"
+"\t\t\tcount += ch\n"
+"\t\telif ch in 'sp':\n"
+"\t\t\tfields.append(None)\n"
+"\t\t\tcount = ''\n"
+"\t\telif ch == 'x':\n"
+"\t\t\tcount = ''\n"
+"\t\telif not ch.isspace():\n"
+"\t\t\tfields += [_pipo_formats.get(ch)] * int(count or 1)\n"
+"\t\t\tcount = ''\n"
+"\treturn fields\n"
+"def _pipo_encode(args):\n"
+"\treturn [v.encode() if isinstance(v, str) else v for v in args]\n"
+"def _pipo_native(args, fields=None):\n"
+"\tif fields is not None:\n"
+"\t\treturn [v if t is None else t(v) for t, v in zip(fields, args)]\n"
+"\treturn [c_double(v) if isinstance(v, float) else\n"
+"\t\tv.encode() if isinstance(v, str) else v for v in args]\n"
+"class _PipoRecord(object):\n"
+"\tdef __init__(self, path, index, args):\n"
+"\t\tself.path, self.index, self.args = path, index, args\n"
+"\tdef __str__(self):\n"
+"\t\treturn '%s: record %d, arguments %r' % (\n"
+"\t\t\tself.path, self.index, self.args)\n";
+
+/* Python helper to consume a generator of the prototype lazily in
+   batches.  */
+static const char *generator_helpers =
+"def _pipo_generated(gen, size=1024):\n"
+"\tit, index = iter(gen), 0\n"
+"\twhile True:\n"
+"\t\tbatch = list(itertools.islice(it, size))\n"
+"\t\tif not batch:\n"
+"\t\t\treturn\n"
+"\t\tfor args in batch:\n"
+"\t\t\tyield index, args if isinstance(args, tuple) else (args,)\n"
+"\t\t\tindex += 1\n";
+
+/* Python helper to check cases in chunks.  The library is called
+   for every case, or once per chunk through the batch function of
+   the shim if it is given; the prototype is called for every case,
+   or once per chunk with the list of values of every argument if it
+   is vectorized.  Results are compared case by case only if the
+   lists differ.  Returns the number of cases checked.  */
+static const char *chunk_helpers =
+"def _pipo_chunked(test, native, proto, cases, vectorized, batch=None,\n"
+"\t\t  size=4096):\n"
+"\tif batch is not None:\n"
+"\t\targs = type('args', (Structure,), {'_fields_': [\n"
+"\t\t\t('a%d' % i, t) for i, t in enumerate(native.argtypes)]})\n"
+"\tcases, n = iter(cases), 0\n"
+"\twhile True:\n"
+"\t\tchunk = list(itertools.islice(cases, size))\n"
+"\t\tif not chunk:\n"
+"\t\t\treturn n\n"
+"\t\tn += len(chunk)\n"
+"\t\tif batch is None:\n"
+"\t\t\tgot = [native(*c[0]) for c in chunk]\n"
+"\t\telif native.restype is None:\n"
+"\t\t\tbatch((args * len(chunk))(*[c[1] for c in chunk]), None,\n"
+"\t\t\t      len(chunk))\n"
+"\t\t\tgot = [None] * len(chunk)\n"
+"\t\telse:\n"
+"\t\t\tout = (native.restype * len(chunk))()\n"
+"\t\t\tbatch((args * len(chunk))(*[c[1] for c in chunk]), out,\n"
+"\t\t\t      len(chunk))\n"
+"\t\t\tgot = list(out)\n"
+"\t\tif vectorized:\n"
+"\t\t\texpected = list(proto(*map(list, zip(*[c[1] for c in chunk]))))\n"
+"\t\telse:\n"
+"\t\t\texpected = [proto(*c[1]) for c in chunk]\n"
+"\t\tif got != expected:\n"
+"\t\t\ttest.assertEqual(len(got), len(expected))\n"
+"\t\t\tfor c, g, e in zip(chunk, got, expected):\n"
+"\t\t\t\ttest.assertEqual(g, e, c[2])\n";
+
+/* Python helpers to pass the contents of files.  A file is mapped
+   read-only once per process and the pages of the mapping are used
+   by the tested functions without copying.  The prototype reads
+   the same pages through the mmap module.  */
+static const char *blob_helpers =
+"_pipo_libc = CDLL(None, use_errno=True)\n"
+"_pipo_libc.mmap.restype = c_void_p\n"
+"_pipo_libc.mmap.argtypes = [c_void_p, c_size_t, c_int, c_int, c_int,\n"
+"\t\t\t    c_long]\n"
+"_pipo_blobs = {}\n"
+"def _pipo_blob(path, offset=0, length=None):\n"
+"\tif path not in _pipo_blobs:\n"
+"\t\twith open(path, 'rb') as f:\n"
+"\t\t\tsize = os.fstat(f.fileno()).st_size\n"
+"\t\t\taddr, view = 0, memoryview(b'')\n"
+"\t\t\tif size:\n"
+"\t\t\t\taddr = _pipo_libc.mmap(None, size, mmap.PROT_READ,\n"
+"\t\t\t\t\t\t      mmap.MAP_SHARED, f.fileno(), 0)\n"
+"\t\t\t\tif addr == c_void_p(-1).value:\n"
+"\t\t\t\t\traise OSError(get_errno(), 'mmap failed', path)\n"
+"\t\t\t\tview = memoryview(mmap.mmap(f.fileno(), 0,\n"
+"\t\t\t\t\t\t\t  access=mmap.ACCESS_READ))\n"
+"\t\t_pipo_blobs[path] = (addr, view, size)\n"
+"\taddr, view, size = _pipo_blobs[path]\n"
+"\tif length is None:\n"
+"\t\tlength = size - offset\n"
+"\tif offset + length > size:\n"
+"\t\traise ValueError('%s: blob is out of the file' % path)\n"
+"\treturn addr + offset, view[offset:offset + length], length\n";
+
+/* Python helper to compare the buffers after the call.  */
+static const char *buffer_helpers =
+"_pipo_memcmp = CDLL(None).memcmp\n"
+"_pipo_memcmp.argtypes = [c_void_p, c_void_p, c_size_t]\n"
+"_pipo_memcmp.restype = c_int\n";
+
+/* Set if the tested functions are called through a CPython extension
+   module instead of ctypes.  */
+static bool cpython = false;
+
+/* Units of the cases split among the shards, and the shard being
+   generated, or -1 if the test is not sharded.  */
+static struct shard_unit *shard_units = NULL;
+static size_t shard_count = 0;
+static int shard_current = -1;
+
+/* Check if the case ARGS belongs to the shard being generated.  */
+static bool
+codegen_in_shard_p (tree args)
+{
+  return shard_current < 0
+	 || shard_lookup (shard_units, shard_count, args,
+			  shard_current) != NULL;
+}
+
+/* Check if any case of FUNCTION belongs to the shard being
+   generated.  */
+static bool
+codegen_function_in_shard_p (tree function)
+{
+  struct tree_list_element *el;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 1)), el)
+    if (codegen_in_shard_p (el->entry))
+      return true;
+  return false;
+}
+
+/* Check if any function of MODULE is tested in the shard being
+   generated.  */
+static bool
+codegen_module_in_shard_p (tree module)
+{
+  struct tree_list_element *el;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), el)
+    if (codegen_function_in_shard_p (el->entry))
+      return true;
+  return false;
+}
+
+/* Check if the function FUNCTION can be called through the extension
+   module: its signature is known, it takes numbers and strings and
+   no buffers are passed to it.  */
+static bool
+codegen_ext_p (tree function)
+{
+  struct tree_list_element *el, *al;
+  enum type_code code;
+
+  if (TREE_OPERAND (function, 2) == NULL)
+    return false;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 2)), el)
+    {
+      code = type_lookup (TREE_VALUE (el->entry));
+      if (!TYPE_IS_NUMBER (code) && code != TYPE_STR
+	  && (el != TREE_LIST (TREE_OPERAND (function, 2))
+	      || code != TYPE_VOID))
+	return false;
+    }
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 1)), el)
+    if (TREE_CODE (el->entry) == LIST)
+      DL_FOREACH (TREE_LIST (el->entry), al)
+	if (TREE_CODE (al->entry) == BLOB || TREE_CODE (al->entry) == ARRAY
+	    || TREE_CODE (al->entry) == OUTBUF)
+	  return false;
+  return true;
+}
+
+/* Name of the attribute of the test holding the function FUNCTION:
+   `ext' for the extension module or `lib' for the ctypes library.  */
+static const char *
+codegen_callee (tree function)
+{
+  return cpython && codegen_ext_p (function) ? "ext" : "lib";
+}
+
+/* Print a literal value.  Octal numbers are written with `0o'
+   prefix as python does not accept leading zeroes.  */
+static void
+codegen_literal (FILE* f, tree t)
+{
+  const char *val = TREE_VALUE (t);
+
+  if (val[0] == '-')
+    fprintf (f, "%c", *val++);
+
+  if (val[0] == '0' && val[1] >= '0' && val[1] <= '7')
+    {
+      while (*val == '0' && val[1] != '\0')
+	val++;
+      fprintf (f, "0o%s", val);
+    }
+  else
+    fprintf (f, "%s", val);
+}
+
+/* Print arguments of the case T.  If NATIVE is set, arguments
+   are passed to the C library and typed values are wrapped in
+   ctypes constructors, unless the signature of the function
+   FUNCTION is known.  */
 int
-codegen_atomic_value (FILE* f, tree t)
+codegen_atomic_value (FILE* f, tree t, tree function, bool native)
 {
   struct tree_list_element *el;
+  bool wrap = native && (function == NULL
+			 || TREE_OPERAND (function, 2) == NULL);
+  int i = 0;
   assert (TREE_CODE (t) == LIST, "list expected");
   DL_FOREACH (TREE_LIST (t), el)
     {
-      fprintf (f, "%s", TREE_VALUE (el->entry));
+      /* Generated arguments are bound to the loop variables.  */
+      if (TREE_CODE (el->entry) == RANGE)
+	fprintf (f, "a%i", i);
+      else if (TREE_CODE (el->entry) == RANDOM && wrap)
+	fprintf (f, "%s(a%i)", TYPE_CTYPES (type_lookup (
+		    TREE_VALUE (TREE_OPERAND (el->entry, 0)))), i);
+      else if (TREE_CODE (el->entry) == RANDOM)
+	fprintf (f, "a%i", i);
+      else if ((TREE_CODE (el->entry) == ARRAY
+		|| TREE_CODE (el->entry) == OUTBUF))
+	fprintf (f, "b%i[%i]", i, native ? 0 : 1);
+      else if (TREE_CODE (el->entry) == BLOB && native)
+	fprintf (f, "c_void_p(a%i[0]), c_size_t(a%i[2])", i, i);
+      else if (TREE_CODE (el->entry) == BLOB)
+	fprintf (f, "a%i[1], a%i[2]", i, i);
+      else
+	{
+	  /* C strings are passed as bytes.  */
+	  if (native && TREE_VALUE (el->entry)[0] == '"')
+	    fprintf (f, "b");
+	  codegen_literal (f, el->entry);
+	}
       if (el->next != NULL)
 	fprintf (f, ", ");
+      i++;
     }
   return 0;
 }
 
-int
-codegen (char *file)
+/* Check if any case of the module MODULE in the shard being
+   generated has an argument with the tree code CODE.  */
+static bool
+codegen_uses (tree module, enum tree_code code)
 {
-  struct tree_list_element *tl, *tll, *tlll;
-  int function_error = 0;
+  struct tree_list_element *tll, *tlll, *el;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tll)
+    DL_FOREACH (TREE_LIST (TREE_OPERAND (tll->entry, 1)), tlll)
+      {
+	if (!codegen_in_shard_p (tlll->entry))
+	  continue;
+	if (TREE_CODE (tlll->entry) == code)
+	  return true;
+	if (TREE_CODE (tlll->entry) != LIST)
+	  continue;
+	DL_FOREACH (TREE_LIST (tlll->entry), el)
+	  if (TREE_CODE (el->entry) == code)
+	    return true;
+      }
+  return false;
+}
+
+/* Print the argument tuple of the case T, used as a message
+   of the assertion to identify a failed case in a loop.  */
+static void
+codegen_args_tuple (FILE* f, tree t)
+{
+  fprintf (f, "(");
+  codegen_atomic_value (f, t, NULL, false);
+  fprintf (f, TREE_LIST (t)->next == NULL ? ",)" : ")");
+}
+
+static void
+codegen_indent (FILE* f, int depth)
+{
+  while (depth-- > 0)
+    fprintf (f, "\t");
+}
+
+/* Count a call at DEPTH in the test of a shard, whose time is
+   written with the number of calls.  */
+static void
+codegen_count (FILE* f, int depth)
+{
+  if (shard_current < 0)
+    return;
+  codegen_indent (f, depth);
+  fprintf (f, "calls += 1\n");
+}
+
+/* Print the elements of the array T as python bytes literal in
+   the memory layout of the host.  The literal is copied into
+   the preallocated buffer before each call.  */
+static void
+codegen_array_image (FILE* f, tree t)
+{
+  enum type_code code = type_lookup (TREE_VALUE (TREE_OPERAND (t, 0)));
+  size_t i, size = TYPE_SIZE (code);
+  struct tree_list_element *el;
+  unsigned char bytes[8];
+
+  fprintf (f, "b'");
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (t, 1)), el)
+    {
+      const char *v = TREE_VALUE (el->entry);
+      unsigned long long x = v[0] == '-'
+			     ? (unsigned long long) strtoll (v, NULL, 0)
+			     : strtoull (v, NULL, 0);
+
+      if (TYPE_CLASS (code) == type_real && size == sizeof (float))
+	{
+	  float r = strtod (v, NULL);
+	  memcpy (bytes, &r, size);
+	}
+      else if (TYPE_CLASS (code) == type_real)
+	{
+	  double r = strtod (v, NULL);
+	  memcpy (bytes, &r, size);
+	}
+      else if (size == 1)
+	{
+	  uint8_t r = x;
+	  memcpy (bytes, &r, size);
+	}
+      else if (size == 2)
+	{
+	  uint16_t r = x;
+	  memcpy (bytes, &r, size);
+	}
+      else if (size == 4)
+	{
+	  uint32_t r = x;
+	  memcpy (bytes, &r, size);
+	}
+      else
+	memcpy (bytes, &x, size);
+
+      for (i = 0; i < size; i++)
+	fprintf (f, "\\x%02x", bytes[i]);
+    }
+  fprintf (f, "'");
+}
+
+/* Number of bytes in the array or in the output buffer T.  */
+static size_t
+buffer_size (tree t)
+{
+  struct tree_list_element *el;
+  size_t n = 0;
+
+  if (TREE_CODE (t) == OUTBUF)
+    n = strtoull (TREE_VALUE (TREE_OPERAND (t, 1)), NULL, 0);
+  else
+    DL_FOREACH (TREE_LIST (TREE_OPERAND (t, 1)), el)
+      n++;
+  return n * TYPE_SIZE (type_lookup (TREE_VALUE (TREE_OPERAND (t, 0))));
+}
+
+/* Allocate buffers for the arrays and output buffers passed to
+   FUNCTION.  A pair of buffers, for the library and for the
+   prototype, is allocated once per argument position and it is
+   large enough for any case of the function.  */
+static int
+codegen_buffers (FILE* f, tree function)
+{
+  struct tree_list_element *tl, *el;
+  tree *types = NULL;
+  size_t *sizes = NULL;
+  int i, n = 0, ret = 0;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 1)), tl)
+    {
+      if (TREE_CODE (tl->entry) != LIST)
+	continue;
+      i = 0;
+      DL_FOREACH (TREE_LIST (tl->entry), el)
+	{
+	  tree t = el->entry;
+	  if (i >= n)
+	    {
+	      types = (tree *) realloc (types, (i + 1) * sizeof (tree));
+	      sizes = (size_t *) realloc (sizes, (i + 1) * sizeof (size_t));
+	      types[i] = NULL;
+	      sizes[i] = 0;
+	      n = i + 1;
+	    }
+	  if (TREE_CODE (t) == ARRAY || TREE_CODE (t) == OUTBUF)
+	    {
+	      if (types[i] != NULL
+		  && strcmp (TREE_VALUE (TREE_OPERAND (types[i], 0)),
+			     TREE_VALUE (TREE_OPERAND (t, 0))))
+		{
+		  error_loc (TREE_LOCATION (t), "buffers passed as argument "
+			     "%i of `%s' have different types", i + 1,
+			     TREE_VALUE (TREE_OPERAND (function, 0)));
+		  ret++;
+		}
+	      types[i] = t;
+	      if (buffer_size (t) > sizes[i])
+		sizes[i] = buffer_size (t);
+	    }
+	  i++;
+	}
+    }
+
+  for (i = 0; i < n; i++)
+    if (types[i] != NULL)
+      {
+	enum type_code code;
+
+	code = type_lookup (TREE_VALUE (TREE_OPERAND (types[i], 0)));
+	fprintf (f, "\t\tb%i = (%s * %zu)(), (%s * %zu)()\n", i,
+		 TYPE_CTYPES (code), sizes[i] / TYPE_SIZE (code),
+		 TYPE_CTYPES (code), sizes[i] / TYPE_SIZE (code));
+      }
+
+  free (types);
+  free (sizes);
+  return ret;
+}
+
+/* Generate a loop over the cases stored in the file described
+   by the node T.  If VECTORIZED is set, the cases are yielded
+   instead of being checked.  */
+static void
+codegen_file_cases (FILE* f, tree function, tree t, bool vectorized)
+{
+  const char *path = TREE_VALUE (TREE_OPERAND (t, 0));
+  tree fmt = TREE_OPERAND (t, 1);
+  int depth = vectorized ? 3 : 2;
+
+  /* Fields of the records are converted to the types of the format,
+     unless the signature is known.  */
+  if (fmt != NULL)
+    {
+      if (TREE_OPERAND (function, 2) == NULL)
+	{
+	  codegen_indent (f, depth);
+	  fprintf (f, "fields = _pipo_fields(%s)\n", TREE_VALUE (fmt));
+	}
+      codegen_indent (f, depth);
+      fprintf (f, "for i, args in enumerate(_pipo_records(%s, %s)):\n",
+	       path, TREE_VALUE (fmt));
+      codegen_indent (f, depth + 1);
+      if (TREE_OPERAND (function, 2) == NULL)
+	fprintf (f, "native = _pipo_native(args, fields)\n");
+      else
+	fprintf (f, "native = _pipo_encode(args)\n");
+    }
+  else
+    {
+      codegen_indent (f, depth);
+      fprintf (f, "for i, args in enumerate(_pipo_csv(%s)):\n", path);
+      codegen_indent (f, depth + 1);
+      if (TREE_OPERAND (function, 2) == NULL)
+	fprintf (f, "native = _pipo_native(args)\n");
+      else
+	fprintf (f, "native = _pipo_encode(args)\n");
+    }
+
+  codegen_indent (f, depth + 1);
+  if (vectorized)
+    fprintf (f, "yield native, args, _PipoRecord(%s, i, args)\n", path);
+  else
+    {
+      fprintf (f, "self.assertEqual(call(*native), proto(*args), "
+		  "_PipoRecord(%s, i, args))\n", path);
+      codegen_count (f, depth + 1);
+    }
+}
+
+/* Generate a loop over the cases produced by the generator of the
+   prototype described by the node T.  If VECTORIZED is set, the
+   cases are yielded instead of being checked.  */
+static void
+codegen_generator_cases (FILE* f, tree module, tree function, tree t,
+			 bool vectorized)
+{
+  const char *mod = TREE_VALUE (TREE_OPERAND (module, 0));
+  const char *gen = TREE_VALUE (TREE_OPERAND (t, 0));
+  int depth = vectorized ? 3 : 2;
+
+  codegen_indent (f, depth);
+  fprintf (f, "for i, args in _pipo_generated(%s.%s()):\n", mod, gen);
+  codegen_indent (f, depth + 1);
+  if (TREE_OPERAND (function, 2) == NULL)
+    fprintf (f, "native = _pipo_native(args)\n");
+  else
+    fprintf (f, "native = _pipo_encode(args)\n");
+  codegen_indent (f, depth + 1);
+  if (vectorized)
+    fprintf (f, "yield native, args, _PipoRecord('%s()', i, args)\n", gen);
+  else
+    {
+      fprintf (f, "self.assertEqual(call(*native), proto(*args), "
+		  "_PipoRecord('%s()', i, args))\n", gen);
+      codegen_count (f, depth + 1);
+    }
+}
+
+/* Check if all the arguments of the case T are literals.  Such
+   cases are gathered into a table.  */
+static bool
+codegen_table_case_p (tree t)
+{
+  struct tree_list_element *el;
+
+  if (TREE_CODE (t) != LIST || TREE_LIST (t) == NULL)
+    return false;
+  DL_FOREACH (TREE_LIST (t), el)
+    if (TREE_CODE (el->entry) != VALUE)
+      return false;
+  return true;
+}
+
+/* Generate the table of the cases of the function FUNCTION whose
+   arguments are literals, and a single loop checking them.  Every
+   case is reported by subTest, so the size of the code does not
+   grow with the number of cases.  If VECTORIZED is set, the cases
+   are yielded instead of being checked.  */
+static void
+codegen_table (FILE* f, tree function, bool vectorized)
+{
+  struct tree_list_element *el;
+  int depth = vectorized ? 3 : 2;
+  bool empty = true;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 1)), el)
+    if (codegen_table_case_p (el->entry) && codegen_in_shard_p (el->entry))
+      {
+	if (empty)
+	  {
+	    codegen_indent (f, depth);
+	    fprintf (f, "table = (\n");
+	    empty = false;
+	  }
+	codegen_indent (f, depth + 1);
+	codegen_args_tuple (f, el->entry);
+	fprintf (f, ",\n");
+      }
+  if (empty)
+    return;
+
+  codegen_indent (f, depth);
+  fprintf (f, ")\n");
+  codegen_indent (f, depth);
+  fprintf (f, "for args in table:\n");
+  codegen_indent (f, depth + 1);
+  if (TREE_OPERAND (function, 2) == NULL)
+    fprintf (f, "native = _pipo_native(args)\n");
+  else
+    fprintf (f, "native = _pipo_encode(args)\n");
+  codegen_indent (f, depth + 1);
+  if (vectorized)
+    {
+      fprintf (f, "yield native, args, args\n");
+      return;
+    }
+  fprintf (f, "with self.subTest(args=args):\n");
+  codegen_indent (f, depth + 2);
+  fprintf (f, "self.assertEqual(call(*native), proto(*args))\n");
+  codegen_count (f, depth + 1);
+}
+
+/* Generate the table of the cases of the function FUNCTION with
+   expected values.  The results of the library are compared with
+   these values, the prototype is not called.  */
+static void
+codegen_expect_table (FILE* f, tree function)
+{
+  struct tree_list_element *el;
+  bool empty = true;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 1)), el)
+    if (TREE_CODE (el->entry) == EXPECT && codegen_in_shard_p (el->entry))
+      {
+	tree value = TREE_OPERAND (el->entry, 1);
+
+	if (empty)
+	  {
+	    fprintf (f, "\t\ttable = (\n");
+	    empty = false;
+	  }
+	fprintf (f, "\t\t\t(");
+	codegen_args_tuple (f, TREE_OPERAND (el->entry, 0));
+	fprintf (f, ", %s", TREE_VALUE (value)[0] == '"' ? "b" : "");
+	codegen_literal (f, value);
+	fprintf (f, "),\n");
+      }
+  if (empty)
+    return;
+
+  fprintf (f, "\t\t)\n"
+	      "\t\tfor args, expected in table:\n");
+  if (TREE_OPERAND (function, 2) == NULL)
+    fprintf (f, "\t\t\tnative = _pipo_native(args)\n");
+  else
+    fprintf (f, "\t\t\tnative = _pipo_encode(args)\n");
+  fprintf (f, "\t\t\twith self.subTest(args=args):\n"
+	      "\t\t\t\tself.assertEqual(call(*native), expected)\n");
+  codegen_count (f, 3);
+}
+
+/* Check if the function FUNCTION can be called through the batch
+   function of the shim: its signature is known, it takes and
+   returns numbers only, and no buffers are passed to it.  */
+static bool
+codegen_batch_p (tree function)
+{
+  struct tree_list_element *el, *al;
+  enum type_code code;
+
+  if (TREE_OPERAND (function, 2) == NULL)
+    return false;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 2)), el)
+    {
+      code = type_lookup (TREE_VALUE (el->entry));
+      if (!TYPE_IS_NUMBER (code)
+	  && (el != TREE_LIST (TREE_OPERAND (function, 2))
+	      || code != TYPE_VOID))
+	return false;
+    }
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 1)), el)
+    if (TREE_CODE (el->entry) == LIST)
+      DL_FOREACH (TREE_LIST (el->entry), al)
+	if (TREE_CODE (al->entry) == BLOB || TREE_CODE (al->entry) == ARRAY
+	    || TREE_CODE (al->entry) == OUTBUF
+	    || (TREE_CODE (al->entry) == VALUE
+		&& TREE_VALUE (al->entry)[0] == '"'))
+	  return false;
+  return true;
+}
+
+/* Check if the cases of FUNCTION in the shard being generated are
+   checked in chunks: the function is vectorized or called through
+   the shim, and it has cases without expected values.  BATCH is set
+   if it is called through the shim.  */
+static bool
+codegen_chunked_p (tree function, bool *batch)
+{
+  struct tree_list_element *el;
+
+  *batch = codegen_batch_p (function)
+	   && strcmp (codegen_callee (function), "lib") == 0;
+  if (!*batch && !function_attribute_p (function, "vectorized"))
+    return false;
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 1)), el)
+    if (TREE_CODE (el->entry) != EXPECT && codegen_in_shard_p (el->entry))
+      return true;
+  return false;
+}
+
+/* Write the C shim of the module MODULE to the file `NAME_shim.c'.
+   For every function that can be batched the shim exports
+     void run_batch_<f> (const struct pipo_args_<f> *in,
+			 <result> *out, size_t n)
+   which calls the function for N packed cases.  The shim is built
+   as `lib<module>_shim.so' and linked with the library.  Returns
+   non-zero on error.  */
+static int
+codegen_shim (tree module)
+{
+  struct tree_list_element *tl, *el;
+  const char *mod = TREE_VALUE (TREE_OPERAND (module, 0));
+  struct output out;
+  char *filename = NULL;
+  const char *name, *ret;
+  FILE* f = NULL;
+  int i;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tl)
+    {
+      tree sig;
+
+      if (!codegen_batch_p (tl->entry))
+	continue;
+
+      if (f == NULL)
+	{
+	  if (-1 == asprintf (&filename, "%s_shim.c", mod))
+	    err (EXIT_FAILURE, "asprintf failed");
+	  f = output_open (&out, filename);
+	  free (filename);
+	  fprintf (f, "/* Batch calls of module `%s', generated by PIPO.\n"
+		      "   Build with: cc -shared -fpic %s_shim.c -L. -l%s "
+		      "-o lib%s_shim.so  */\n\n"
+		      "#include <stddef.h>\n"
+		      "#include <stdint.h>\n", mod, mod, mod, mod);
+	}
+
+      name = TREE_VALUE (TREE_OPERAND (tl->entry, 0));
+      sig = TREE_OPERAND (tl->entry, 2);
+      ret = TYPE_CTYPE (type_lookup (TREE_VALUE (TREE_LIST (sig)->entry)));
+
+      fprintf (f, "\nstruct pipo_args_%s\n{\n", name);
+      for (el = TREE_LIST (sig)->next, i = 0; el != NULL; el = el->next)
+	fprintf (f, "  %s a%i;\n",
+		 TYPE_CTYPE (type_lookup (TREE_VALUE (el->entry))), i++);
+      fprintf (f, "};\n\nextern %s %s (", ret, name);
+      for (el = TREE_LIST (sig)->next; el != NULL; el = el->next)
+	fprintf (f, "%s%s", TYPE_CTYPE (type_lookup (TREE_VALUE (el->entry))),
+		 el->next != NULL ? ", " : "");
+      fprintf (f, "%s);\n\n", TREE_LIST (sig)->next == NULL ? "void" : "");
+
+      fprintf (f, "void\nrun_batch_%s (const struct pipo_args_%s *in, "
+		  "%s *out, size_t n)\n{\n"
+		  "  size_t i;\n\n"
+		  "  for (i = 0; i < n; i++)\n"
+		  "    %s%s (", name, name,
+		  strcmp (ret, "void") == 0 ? "void" : ret,
+		  strcmp (ret, "void") == 0 ? "" : "out[i] = ", name);
+      for (el = TREE_LIST (sig)->next, i = 0; el != NULL; el = el->next)
+	fprintf (f, "in[i].a%i%s", i++, el->next != NULL ? ", " : "");
+      fprintf (f, ");\n}\n");
+    }
+
+  if (f != NULL)
+    return output_close (&out);
+  return 0;
+}
+
+/* Write the extension module `_pipo_<module>' of the module MODULE
+   to the file `<module>_ext.c'.  Every function that can be called
+   through the extension gets a METH_FASTCALL wrapper converting the
+   arguments and the result as ctypes does with the same signature.
+   Returns non-zero on error.  */
+static int
+codegen_extension (tree module)
+{
+  struct tree_list_element *tl, *el;
+  const char *mod = TREE_VALUE (TREE_OPERAND (module, 0));
+  struct output out;
+  char *filename = NULL;
+  const char *name;
+  enum type_code ret, code;
   FILE* f;
-  const char* extension = ".py";
-  char* filename = NULL;
-  if (-1 == asprintf (&filename, "%s%s", file, extension))
+  int i;
+
+  if (-1 == asprintf (&filename, "%s_ext.c", mod))
     err (EXIT_FAILURE, "asprintf failed");
-  
-  /* File to write files to.  */
-  if ((f = fopen (filename, "w")) == NULL)
+  f = output_open (&out, filename);
+  free (filename);
+
+  fprintf (f, "/* Extension module calling module `%s', generated by PIPO.\n"
+	      "   Build with: cc -shared -fpic $(python3-config --includes) "
+	      "%s_ext.c\n"
+	      "     -L. -l%s -Wl,-rpath,'$ORIGIN' "
+	      "-o _pipo_%s$(python3-config --extension-suffix)  */\n\n"
+	      "#define PY_SSIZE_T_CLEAN\n"
+	      "#include <Python.h>\n"
+	      "#include <stdint.h>\n", mod, mod, mod, mod);
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tl)
     {
-      fprintf (stderr, "Can't open file `%s' for writing", filename);
-      return 1;
+      tree sig = TREE_OPERAND (tl->entry, 2);
+      int n = 0;
+
+      if (!codegen_ext_p (tl->entry))
+	continue;
+
+      name = TREE_VALUE (TREE_OPERAND (tl->entry, 0));
+      ret = type_lookup (TREE_VALUE (TREE_LIST (sig)->entry));
+      for (el = TREE_LIST (sig)->next; el != NULL; el = el->next)
+	n++;
+
+      fprintf (f, "\nextern %s %s (", TYPE_CTYPE (ret), name);
+      for (el = TREE_LIST (sig)->next; el != NULL; el = el->next)
+	fprintf (f, "%s%s", TYPE_CTYPE (type_lookup (TREE_VALUE (el->entry))),
+		 el->next != NULL ? ", " : "");
+      fprintf (f, "%s);\n\n", n == 0 ? "void" : "");
+
+      fprintf (f, "static PyObject *\n"
+		  "pipo_%s (PyObject *self, PyObject *const *args, "
+		  "Py_ssize_t nargs)\n{\n", name);
+      for (el = TREE_LIST (sig)->next, i = 0; el != NULL; el = el->next)
+	fprintf (f, "  %s a%i;\n",
+		 TYPE_CTYPE (type_lookup (TREE_VALUE (el->entry))), i++);
+      if (ret != TYPE_VOID)
+	fprintf (f, "  %s r;\n", TYPE_CTYPE (ret));
+      fprintf (f, "\n  (void) self;\n"
+		  "  if (nargs != %i)\n"
+		  "    {\n"
+		  "      PyErr_SetString (PyExc_TypeError, "
+		  "\"%s() takes %i arguments\");\n"
+		  "      return NULL;\n"
+		  "    }\n", n, name, n);
+
+      /* Integers are truncated and strings are passed as bytes or
+	 None, as ctypes does.  */
+      for (el = TREE_LIST (sig)->next, i = 0; el != NULL; el = el->next, i++)
+	{
+	  code = type_lookup (TREE_VALUE (el->entry));
+	  if (TYPE_CLASS (code) == type_real)
+	    fprintf (f, "  a%i = (%s) PyFloat_AsDouble (args[%i]);\n",
+		     i, TYPE_CTYPE (code), i);
+	  else if (code == TYPE_STR)
+	    fprintf (f, "  a%i = args[%i] == Py_None ? NULL "
+			": PyBytes_AsString (args[%i]);\n", i, i, i);
+	  else
+	    fprintf (f, "  a%i = (%s) PyLong_AsUnsignedLongLongMask "
+			"(args[%i]);\n", i, TYPE_CTYPE (code), i);
+	}
+      fprintf (f, "  if (PyErr_Occurred ())\n"
+		  "    return NULL;\n\n"
+		  "  %s%s (", ret == TYPE_VOID ? "" : "r = ", name);
+      for (i = 0; i < n; i++)
+	fprintf (f, "a%i%s", i, i + 1 < n ? ", " : "");
+      fprintf (f, ");\n");
+
+      switch (TYPE_CLASS (ret))
+	{
+	case type_signed:
+	  fprintf (f, "  return PyLong_FromLongLong (r);\n");
+	  break;
+	case type_unsigned:
+	  fprintf (f, "  return PyLong_FromUnsignedLongLong (r);\n");
+	  break;
+	case type_real:
+	  fprintf (f, "  return PyFloat_FromDouble (r);\n");
+	  break;
+	case type_pointer:
+	  fprintf (f, "  if (r == NULL)\n"
+		      "    Py_RETURN_NONE;\n"
+		      "  return PyBytes_FromString (r);\n");
+	  break;
+	default:
+	  fprintf (f, "  Py_RETURN_NONE;\n");
+	  break;
+	}
+      fprintf (f, "}\n");
     }
 
-  fprintf (f, "import unittest\n");
-  fprintf (f, "from ctypes import cdll\n");
-  DL_FOREACH (TREE_LIST (module_list), tl)
-    fprintf (f, "import %s\n", TREE_VALUE (TREE_OPERAND (tl->entry, 0)));
+  fprintf (f, "\nstatic PyMethodDef pipo_methods[] =\n{\n");
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tl)
+    if (codegen_ext_p (tl->entry))
+      fprintf (f, "  { \"%s\", (PyCFunction) (void (*) (void)) pipo_%s,\n"
+		  "    METH_FASTCALL, NULL },\n",
+	       TREE_VALUE (TREE_OPERAND (tl->entry, 0)),
+	       TREE_VALUE (TREE_OPERAND (tl->entry, 0)));
+  fprintf (f, "  { NULL, NULL, 0, NULL }\n"
+	      "};\n\n"
+	      "static struct PyModuleDef pipo_module =\n"
+	      "{\n"
+	      "  PyModuleDef_HEAD_INIT, \"_pipo_%s\", NULL, -1, pipo_methods,\n"
+	      "  NULL, NULL, NULL, NULL\n"
+	      "};\n\n"
+	      "PyMODINIT_FUNC\n"
+	      "PyInit__pipo_%s (void)\n"
+	      "{\n"
+	      "  return PyModule_Create (&pipo_module);\n"
+	      "}\n", mod, mod);
+  return output_close (&out);
+}
 
-  DL_FOREACH (TREE_LIST (module_list), tl)
+/* Declare the types of the arguments and of the result of the
+   function FUNCTION, if its signature is given.  The declarations
+   are in the class method setting up the library.  */
+static void
+codegen_signature (FILE* f, tree function)
+{
+  struct tree_list_element *el;
+  tree sig = TREE_OPERAND (function, 2);
+  const char *name = TREE_VALUE (TREE_OPERAND (function, 0));
+
+  if (sig == NULL)
+    return;
+
+  fprintf (f, "\t\tcls.lib.%s.restype = %s\n", name,
+	   TYPE_CTYPES (type_lookup (TREE_VALUE (TREE_LIST (sig)->entry))));
+  fprintf (f, "\t\tcls.lib.%s.argtypes = [", name);
+  for (el = TREE_LIST (sig)->next; el != NULL; el = el->next)
+    fprintf (f, "%s%s", TYPE_CTYPES (type_lookup (TREE_VALUE (el->entry))),
+	     el->next != NULL ? ", " : "");
+  fprintf (f, "]\n");
+}
+
+/* Generate assertions for the case ARGS of the function FUNCTION.
+   Every range among the arguments becomes a loop, so the size of
+   the code does not depend on the length of the range.  If
+   VECTORIZED is set, the arguments are yielded instead of being
+   checked.  */
+static void
+codegen_case (FILE* f, tree function, tree args, bool vectorized)
+{
+  struct tree_list_element *el;
+  int depth = vectorized ? 3 : 2, i = 0;
+  tree random = NULL;
+
+  /* Files are mapped before the loops.  */
+  DL_FOREACH (TREE_LIST (args), el)
     {
-      fprintf (f, "class Test_%s(unittest.TestCase):\n"
-		  "\tdef setUp(self):\n"
-		  "\t\tself.lib = cdll.LoadLibrary('./lib%s.so')\n",
-		  TREE_VALUE (TREE_OPERAND (tl->entry, 0)),
-		  TREE_VALUE (TREE_OPERAND (tl->entry, 0)));
-      DL_FOREACH (TREE_LIST (TREE_OPERAND (tl->entry, 1)), tll)
+      tree t = el->entry;
+      if (TREE_CODE (t) == BLOB)
 	{
-	  fprintf (f, "\tdef test_%s(self):\n",
-		      TREE_VALUE (TREE_OPERAND (tll->entry, 0)));
-	  DL_FOREACH (TREE_LIST (TREE_OPERAND (tll->entry, 1)), tlll)
+	  codegen_indent (f, depth);
+	  fprintf (f, "a%i = _pipo_blob(%s, ", i,
+		   TREE_VALUE (TREE_OPERAND (t, 0)));
+	  codegen_literal (f, TREE_OPERAND (t, 1));
+	  if (TREE_OPERAND (t, 2) != NULL)
 	    {
-	      fprintf (f, "\t\tself.assertEqual(self.lib.%s(",
-			  TREE_VALUE (TREE_OPERAND (tll->entry, 0)));
-	      codegen_atomic_value (f, tlll->entry);
-	      fprintf (f, "), %s.%s(",
-			  TREE_VALUE (TREE_OPERAND (tl->entry, 0)),
-			  TREE_VALUE (TREE_OPERAND (tll->entry, 0)));
-	      codegen_atomic_value (f, tlll->entry);	
-	      fprintf (f, "))\n");
+	      fprintf (f, ", ");
+	      codegen_literal (f, TREE_OPERAND (t, 2));
 	    }
+	  fprintf (f, ")\n");
+	}
+      i++;
+    }
+
+  i = 0;
+  DL_FOREACH (TREE_LIST (args), el)
+    {
+      tree t = el->entry;
+      if (TREE_CODE (t) == RANGE)
+	{
+	  codegen_indent (f, depth++);
+	  fprintf (f, "for a%i in range(", i);
+	  codegen_literal (f, TREE_OPERAND (t, 0));
+	  fprintf (f, ", ");
+	  codegen_literal (f, TREE_OPERAND (t, 1));
+	  fprintf (f, " + 1, ");
+	  codegen_literal (f, TREE_OPERAND (t, 2));
+	  fprintf (f, "):\n");
+	}
+      else if (TREE_CODE (t) == RANDOM && random == NULL)
+	random = t;
+      i++;
+    }
+
+  /* All random arguments are drawn in the innermost loop over
+     the indexes of the cases.  */
+  if (random != NULL)
+    {
+      codegen_indent (f, depth++);
+      fprintf (f, "for i in _pipo_indices(%s):\n",
+	       TREE_VALUE (TREE_OPERAND (random, 1)));
+      i = 0;
+      DL_FOREACH (TREE_LIST (args), el)
+	{
+	  tree t = el->entry;
+	  if (TREE_CODE (t) == RANDOM)
+	    {
+	      enum type_code code;
+
+	      code = type_lookup (TREE_VALUE (TREE_OPERAND (t, 0)));
+	      codegen_indent (f, depth);
+	      fprintf (f, "a%i = _pipo_random(%s, %i, i, %s, %s, %i, '%s')\n",
+		       i, TREE_VALUE (TREE_OPERAND (t, 4)), i,
+		       TREE_VALUE (TREE_OPERAND (t, 2)),
+		       TREE_VALUE (TREE_OPERAND (t, 3)),
+		       TYPE_CLASS (code) == type_real ? (int) TYPE_SIZE (code)
+						      : 0,
+		       TREE_VALUE (TREE_OPERAND (t, 5)));
+	    }
+	  i++;
+	}
+    }
+
+  /* Buffers are reset before every call.  */
+  i = 0;
+  DL_FOREACH (TREE_LIST (args), el)
+    {
+      tree t = el->entry;
+      if (TREE_CODE (t) == ARRAY)
+	{
+	  codegen_indent (f, depth);
+	  fprintf (f, "memmove(b%i[0], ", i);
+	  codegen_array_image (f, t);
+	  fprintf (f, ", %zu); memmove(b%i[1], b%i[0], %zu)\n",
+		   buffer_size (t), i, i, buffer_size (t));
+	}
+      else if (TREE_CODE (t) == OUTBUF)
+	{
+	  codegen_indent (f, depth);
+	  fprintf (f, "memset(b%i[0], 0, %zu); memset(b%i[1], 0, %zu)\n",
+		   i, buffer_size (t), i, buffer_size (t));
+	}
+      i++;
+    }
+
+  if (vectorized)
+    {
+      codegen_indent (f, depth);
+      fprintf (f, "yield (");
+      codegen_atomic_value (f, args, function, true);
+      fprintf (f, ",), ");
+      codegen_args_tuple (f, args);
+      fprintf (f, ", ");
+      if (random != NULL)
+	fprintf (f, "_PipoReplay(i, ");
+      codegen_args_tuple (f, args);
+      fprintf (f, random != NULL ? ")\n" : "\n");
+      return;
+    }
+
+  codegen_indent (f, depth);
+  fprintf (f, "self.assertEqual(call(");
+  codegen_atomic_value (f, args, function, true);
+  fprintf (f, "), proto(");
+  codegen_atomic_value (f, args, function, false);
+  fprintf (f, ")");
+  if (random != NULL)
+    {
+      fprintf (f, ", _PipoReplay(i, ");
+      codegen_args_tuple (f, args);
+      fprintf (f, ")");
+    }
+  else if (depth > 2)
+    {
+      fprintf (f, ", ");
+      codegen_args_tuple (f, args);
+    }
+  fprintf (f, ")\n");
+  codegen_count (f, depth);
+
+  /* Contents of the buffers are compared by a single memcmp.  */
+  i = 0;
+  DL_FOREACH (TREE_LIST (args), el)
+    {
+      tree t = el->entry;
+      if (TREE_CODE (t) == ARRAY || TREE_CODE (t) == OUTBUF)
+	{
+	  size_t n = buffer_size (t);
+	  size_t len = n / TYPE_SIZE (type_lookup (
+					TREE_VALUE (TREE_OPERAND (t, 0))));
+	  codegen_indent (f, depth);
+	  fprintf (f, "if _pipo_memcmp(b%i[0], b%i[1], %zu):\n", i, i, n);
+	  codegen_indent (f, depth + 1);
+	  fprintf (f, "self.fail('argument %i differs: %%r != %%r' %% "
+		      "(b%i[0][:%zu], b%i[1][:%zu]))\n", i + 1, i, len, i, len);
+	}
+      i++;
+    }
+}
+
+/* Generate the case ARGS of FUNCTION, restricted to the values of
+   the first range assigned to the shard being generated.  */
+static void
+codegen_shard_case (FILE* f, tree function, tree args, bool vectorized)
+{
+  struct shard_unit *u = NULL;
+  tree start, end;
+  char buf[32];
+
+  if (shard_current >= 0)
+    u = shard_lookup (shard_units, shard_count, args, shard_current);
+  if (u == NULL || u->range == NULL)
+    {
+      codegen_case (f, function, args, vectorized);
+      return;
+    }
+
+  start = TREE_OPERAND (u->range, 0);
+  end = TREE_OPERAND (u->range, 1);
+  snprintf (buf, sizeof (buf), "%lld", u->lo);
+  TREE_OPERAND_SET (u->range, 0, make_value_str (buf));
+  snprintf (buf, sizeof (buf), "%lld", u->hi);
+  TREE_OPERAND_SET (u->range, 1, make_value_str (buf));
+  codegen_case (f, function, args, vectorized);
+  free_tree (TREE_OPERAND (u->range, 0));
+  free_tree (TREE_OPERAND (u->range, 1));
+  TREE_OPERAND_SET (u->range, 0, start);
+  TREE_OPERAND_SET (u->range, 1, end);
+}
+
+/* Check if the prototype of FUNCTION is called by the test: some of
+   its cases have no expected values.  */
+static bool
+codegen_proto_p (tree function)
+{
+  struct tree_list_element *el;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 1)), el)
+    if (TREE_CODE (el->entry) != EXPECT)
+      return true;
+  return false;
+}
+
+/* Stamp written on the first line of the test of the module MODULE.
+   It is a hash of the module after the scenarios are merged, of the
+   options that change the test and of the version of PIPO, so a test
+   with the same stamp does not have to be generated again.  The
+   string is allocated and must be freed by the caller.  */
+static char *
+codegen_stamp (tree module)
+{
+  struct tree_list_element *tl, *el;
+  struct shard_unit *u;
+  char *key = NULL, *stamp = NULL, *c;
+  unsigned long long h = 14695981039346656037ULL;
+  size_t size = 0;
+  FILE *f;
+
+  if ((f = open_memstream (&key, &size)) == NULL)
+    err (EXIT_FAILURE, "open_memstream failed");
+  fprintf (f, "%s %s %s %i ", VERSION, COMMIT_DATE,
+	   cpython ? "cpython" : "python", shard_current);
+  c = case_key (module);
+  fprintf (f, "%s", c);
+  free (c);
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tl)
+    DL_FOREACH (TREE_LIST (TREE_OPERAND (tl->entry, 1)), el)
+      if (shard_current >= 0
+	  && (u = shard_lookup (shard_units, shard_count, el->entry,
+				shard_current)) != NULL)
+	fprintf (f, " %lld:%lld:%.0f", u->lo, u->hi, u->calls);
+      else
+	fprintf (f, " %i", shard_current < 0 ? 1 : 0);
+  fclose (f);
+
+  /* FNV-1a.  */
+  for (c = key; *c != '\0'; c++)
+    h = (h ^ (unsigned char) *c) * 1099511628211ULL;
+  free (key);
+  if (-1 == asprintf (&stamp, "# pipo %016llx", h))
+    err (EXIT_FAILURE, "asprintf failed");
+  return stamp;
+}
+
+/* Check if the sources written with the test of the module MODULE
+   exist: the shim, and the extension module with the CPython
+   backend.  They are only written when the test is, so it is
+   generated again if one of them is missing.  */
+static bool
+codegen_sources_p (tree module)
+{
+  struct tree_list_element *tl;
+  const char *mod = TREE_VALUE (TREE_OPERAND (module, 0));
+  bool shim = false, ext = false, ret = true;
+  char *filename = NULL;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tl)
+    {
+      shim |= codegen_batch_p (tl->entry);
+      ext |= cpython && codegen_ext_p (tl->entry);
+    }
+  if (shim)
+    {
+      if (-1 == asprintf (&filename, "%s_shim.c", mod))
+	err (EXIT_FAILURE, "asprintf failed");
+      ret = access (filename, F_OK) == 0;
+      free (filename);
+    }
+  if (ext && ret)
+    {
+      if (-1 == asprintf (&filename, "%s_ext.c", mod))
+	err (EXIT_FAILURE, "asprintf failed");
+      ret = access (filename, F_OK) == 0;
+      free (filename);
+    }
+  return ret;
+}
+
+/* Generate the test of the module MODULE to F: the imports and the
+   helpers it needs, and the class of the test.  */
+static int
+codegen_module (FILE* f, tree module)
+{
+  struct tree_list_element *tll, *tlll;
+  int function_error = 0;
+  bool vec = false, table = false, batch;
+  const char *mod = TREE_VALUE (TREE_OPERAND (module, 0));
+
+  /* Modules used by the helpers are imported once.  */
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tll)
+    vec |= (codegen_function_in_shard_p (tll->entry)
+	    && codegen_chunked_p (tll->entry, &batch));
+  if (codegen_uses (module, FILE_CASES))
+    fprintf (f, "import csv\n");
+  if (vec || codegen_uses (module, GENERATOR))
+    fprintf (f, "import itertools\n");
+  if (codegen_uses (module, BLOB))
+    fprintf (f, "import mmap\n");
+  fprintf (f, "import os\n");
+  if (codegen_uses (module, FILE_CASES))
+    fprintf (f, "import queue\n"
+		"import struct\n"
+		"import threading\n");
+  if (shard_current >= 0)
+    fprintf (f, "import time\n");
+  fprintf (f, "import unittest\n");
+  fprintf (f, "from ctypes import *\n");
+  fprintf (f, "%s", rtld_helpers);
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tll)
+    if (codegen_proto_p (tll->entry))
+      break;
+  if (tll != NULL)
+    fprintf (f, "import %s\n", mod);
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tll)
+    if (cpython && codegen_ext_p (tll->entry))
+      break;
+  if (tll != NULL)
+    {
+      function_error += codegen_extension (module);
+      fprintf (f, "import _pipo_%s\n", mod);
+    }
+  if (codegen_uses (module, RANDOM))
+    fprintf (f, "%s", random_helpers);
+  if (codegen_uses (module, FILE_CASES))
+    fprintf (f, "%s", file_helpers);
+  if (codegen_uses (module, GENERATOR))
+    fprintf (f, "%s", generator_helpers);
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tll)
+    DL_FOREACH (TREE_LIST (TREE_OPERAND (tll->entry, 1)), tlll)
+      table |= ((codegen_table_case_p (tlll->entry)
+		 || TREE_CODE (tlll->entry) == EXPECT)
+		&& codegen_in_shard_p (tlll->entry));
+  if (table || codegen_uses (module, FILE_CASES)
+      || codegen_uses (module, GENERATOR))
+    fprintf (f, "%s", record_helpers);
+  if (codegen_uses (module, BLOB))
+    fprintf (f, "%s", blob_helpers);
+  if (codegen_uses (module, ARRAY) || codegen_uses (module, OUTBUF))
+    fprintf (f, "%s", buffer_helpers);
+  if (vec)
+    fprintf (f, "%s", chunk_helpers);
+  if (shard_current >= 0)
+    fprintf (f, "%s", time_helpers);
+
+  /* Libraries are loaded and functions are declared once per
+     class.  */
+  fprintf (f, "class Test_%s(unittest.TestCase):\n"
+	      "\t@classmethod\n"
+	      "\tdef setUpClass(cls):\n"
+	      "\t\tcls.lib = CDLL('./lib%s.so', _pipo_rtld)\n", mod, mod);
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tll)
+    codegen_signature (f, tll->entry);
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tll)
+    if (cpython && codegen_ext_p (tll->entry))
+      break;
+  if (tll != NULL)
+    fprintf (f, "\t\tcls.ext = _pipo_%s\n", mod);
+
+  /* The shim is optional, functions are called one by one if it is
+     not built.  */
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tll)
+    if (codegen_batch_p (tll->entry))
+      break;
+  if (tll != NULL)
+    {
+      function_error += codegen_shim (module);
+      fprintf (f, "\t\ttry:\n"
+		  "\t\t\tcls.shim = CDLL('./lib%s_shim.so', _pipo_rtld)\n"
+		  "\t\texcept OSError:\n"
+		  "\t\t\tcls.shim = None\n", mod);
+    }
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), tll)
+    {
+      if (!codegen_function_in_shard_p (tll->entry))
+	continue;
+
+      /* Functions are looked up once per test.  */
+      fprintf (f, "\tdef test_%s(self):\n"
+		  "\t\tcall = self.%s.%s\n",
+		  TREE_VALUE (TREE_OPERAND (tll->entry, 0)),
+		  codegen_callee (tll->entry),
+		  TREE_VALUE (TREE_OPERAND (tll->entry, 0)));
+      if (codegen_proto_p (tll->entry))
+	fprintf (f, "\t\tproto = %s.%s\n", mod,
+		 TREE_VALUE (TREE_OPERAND (tll->entry, 0)));
+      if (shard_current >= 0)
+	fprintf (f, "\t\tstarted, calls = time.perf_counter(), 0\n");
+      function_error += codegen_buffers (f, tll->entry);
+
+      /* Cases of a vectorized function or of a function called
+	 through the shim are produced by a local generator and
+	 checked in chunks.  */
+      vec = codegen_chunked_p (tll->entry, &batch);
+      if (vec)
+	fprintf (f, "\t\tdef cases():\n");
+      codegen_table (f, tll->entry, vec);
+      DL_FOREACH (TREE_LIST (TREE_OPERAND (tll->entry, 1)), tlll)
+	if (codegen_table_case_p (tlll->entry)
+	    || TREE_CODE (tlll->entry) == EXPECT
+	    || !codegen_in_shard_p (tlll->entry))
+	  continue;
+	else if (TREE_CODE (tlll->entry) == FILE_CASES)
+	  codegen_file_cases (f, tll->entry, tlll->entry, vec);
+	else if (TREE_CODE (tlll->entry) == GENERATOR)
+	  codegen_generator_cases (f, module, tll->entry, tlll->entry, vec);
+	else
+	  codegen_shard_case (f, tll->entry, tlll->entry, vec);
+      if (vec)
+	fprintf (f, "\t\t%s_pipo_chunked(self, call, proto, cases(), "
+		    "%s%s%s)\n", shard_current >= 0 ? "calls += " : "",
+		    function_attribute_p (tll->entry, "vectorized")
+		    ? "True" : "False",
+		    batch ? ", self.shim and self.shim.run_batch_" : "",
+		    batch ? TREE_VALUE (TREE_OPERAND (tll->entry, 0)) : "");
+      codegen_expect_table (f, tll->entry);
+      if (shard_current >= 0)
+	fprintf (f, "\t\t_pipo_time('%s.%s', started, calls)\n", mod,
+		 TREE_VALUE (TREE_OPERAND (tll->entry, 0)));
+    }
+  return function_error;
+}
+
+/* Generate the python unittest of the modules.  The test of every
+   module is written to `FILE_<module>.py' and `FILE.py' runs all of
+   them.  Files are written only if they change, and the test of a
+   module is not generated again if its stamp is the same.  */
+int
+codegen (char *file)
+{
+  struct tree_list_element *tl;
+  struct output out;
+  int function_error = 0, fresh = 0;
+  char *filename = NULL, *stamp;
+  FILE* f;
+
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    {
+      if (!codegen_module_in_shard_p (tl->entry))
+	continue;
+
+      if (-1 == asprintf (&filename, "%s_%s.py", file,
+			  TREE_VALUE (TREE_OPERAND (tl->entry, 0))))
+	err (EXIT_FAILURE, "asprintf failed");
+      stamp = codegen_stamp (tl->entry);
+      if (output_stamp_p (filename, stamp) && codegen_sources_p (tl->entry))
+	fresh++;
+      else
+	{
+	  f = output_open (&out, filename);
+	  fprintf (f, "%s\n", stamp);
+	  function_error += codegen_module (f, tl->entry);
+	  function_error += output_close (&out);
 	}
+      free (stamp);
+      free (filename);
+      filename = NULL;
     }
 
+  if (-1 == asprintf (&filename, "%s.py", file))
+    err (EXIT_FAILURE, "asprintf failed");
+  f = output_open (&out, filename);
+  free (filename);
+  fprintf (f, "import unittest\n");
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    if (codegen_module_in_shard_p (tl->entry))
+      fprintf (f, "from %s_%s import Test_%s\n", file,
+	       TREE_VALUE (TREE_OPERAND (tl->entry, 0)),
+	       TREE_VALUE (TREE_OPERAND (tl->entry, 0)));
   fprintf (f, "if __name__ == '__main__':\n");
   DL_FOREACH (TREE_LIST (module_list), tl)
-    fprintf (f, "\tsuite = unittest.TestLoader().loadTestsFromTestCase"
-		"(Test_%s)\n" 
-		"\tunittest.TextTestRunner(verbosity=2).run(suite)\n",
-		TREE_VALUE (TREE_OPERAND (tl->entry, 0)));
-  
+    if (codegen_module_in_shard_p (tl->entry))
+      break;
+  /* A shard may get no cases at all.  */
+  if (tl == NULL)
+    fprintf (f, "\tpass\n");
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    if (codegen_module_in_shard_p (tl->entry))
+      fprintf (f, "\tsuite = unittest.TestLoader().loadTestsFromTestCase"
+		  "(Test_%s)\n"
+		  "\tunittest.TextTestRunner(verbosity=2).run(suite)\n",
+		  TREE_VALUE (TREE_OPERAND (tl->entry, 0)));
+  function_error += output_close (&out);
+
+  if (fresh != 0)
+    printf ("note: %i module%s of `%s' %s up to date.\n", fresh,
+	    fresh == 1 ? "" : "s", file, fresh == 1 ? "is" : "are");
   printf ("note: finished generating python code  [ok].\n");
   return function_error;
 }
+
+/* Generate the python unittest calling the functions through the
+   CPython extension modules, and the sources of the modules.  */
+int
+codegen_cpython (char *file)
+{
+  cpython = true;
+  return codegen (file);
+}
+
+/* Generate the test split into N shards `FILE_<k>.py' of similar
+   cost with the backend BACKEND, and the manifest `FILE.shards'
+   listing the shards with their estimated costs.  TIMES is the file
+   with the times measured by a previous run, or NULL.  */
+int
+codegen_shards (int (*backend) (char *), char *file, int n,
+		const char *times)
+{
+  struct output out;
+  char *name = NULL;
+  int ret = 0;
+  FILE *f;
+
+  shard_units = shard_plan (module_list, n, times, &shard_count);
+  if (-1 == asprintf (&name, "%s.shards", file))
+    err (EXIT_FAILURE, "asprintf failed");
+  f = output_open (&out, name);
+
+  for (shard_current = 0; shard_current < n; shard_current++)
+    {
+      free (name);
+      name = NULL;
+      if (-1 == asprintf (&name, "%s_%i", file, shard_current))
+	err (EXIT_FAILURE, "asprintf failed");
+      ret += backend (name);
+      fprintf (f, "%i %f %s.py\n", shard_current,
+	       shard_cost (shard_units, shard_count, shard_current), name);
+    }
+  ret += output_close (&out);
+  printf ("note: %i shards of `%s' written to `%s.shards'.\n", n, file,
+	  file);
+
+  shard_current = -1;
+  free (shard_units);
+  shard_units = NULL;
+  shard_count = 0;
+  free (name);
+  return ret;
+}
@@ -15,6 +15,13 @@
 #ifndef __CODEGEN_H__
 #define __CODEGEN_H__
 
+#include <stdio.h>
+#include "tree.h"
+
 int codegen (char*);
+int codegen_c (char*);
+int codegen_cpython (char*);
+int codegen_atomic_value (FILE*, tree, tree, bool);
+int codegen_shards (int (*) (char*), char*, int, const char*);
 
 #endif /* __CODEGEN_H__ */
@@ -0,0 +1,315 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+/* Generation of a standalone test in C.  The cases with expected
+   values are kept in static tables, one per function, and the
+   results of the library are compared with them natively, so the
+   test needs neither Python nor the prototype.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <err.h>
+
+#include "pipo.h"
+#include "tree.h"
+#include "global.h"
+#include "types.h"
+#include "codegen.h"
+#include "output.h"
+
+/* Check if the type of the argument or of the result CODE can be
+   stored in a table.  */
+static bool
+cgen_type_p (enum type_code code)
+{
+  return TYPE_IS_NUMBER (code) || code == TYPE_STR;
+}
+
+/* Check if the function FUNCTION can be tested by the C harness:
+   its signature is known, and its arguments and result are numbers
+   or strings.  */
+static bool
+cgen_function_p (tree function)
+{
+  struct tree_list_element *el;
+
+  if (TREE_OPERAND (function, 2) == NULL)
+    return false;
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 2)), el)
+    if (!cgen_type_p (type_lookup (TREE_VALUE (el->entry))))
+      return false;
+  return true;
+}
+
+/* Check if the literals of the case T with expected value are of the
+   types of the signature SIG, so that they are not changed when they
+   are stored in the table.  If REPORT is set, the first literal which
+   is not is reported.  */
+static bool
+cgen_case_p (tree sig, tree t, bool report)
+{
+  struct tree_list_element *sl, *al;
+  tree bad = NULL, type = TREE_LIST (sig)->entry;
+
+  if (TREE_CODE (t) != EXPECT)
+    return false;
+  if (!type_value_p (type_lookup (TREE_VALUE (type)),
+		     TREE_VALUE (TREE_OPERAND (t, 1))))
+    bad = TREE_OPERAND (t, 1);
+  for (sl = TREE_LIST (sig)->next, al = TREE_LIST (TREE_OPERAND (t, 0));
+       bad == NULL && sl != NULL && al != NULL; sl = sl->next, al = al->next)
+    if (!type_value_p (type_lookup (TREE_VALUE (sl->entry)),
+		       TREE_VALUE (al->entry)))
+      {
+	bad = al->entry;
+	type = sl->entry;
+      }
+  if (bad != NULL && report)
+    error_loc (TREE_LOCATION (bad), "value `%s' is not of type `%s', "
+	       "the case is skipped", TREE_VALUE (bad), TREE_VALUE (type));
+  return bad == NULL;
+}
+
+/* Print the literal T stored as a value of type CODE, which it has.
+   Integer literals get the suffix of the widest type, so that large
+   unsigned values are not taken as signed.  The smallest 64-bit
+   integer has no literal.  */
+static void
+cgen_literal (FILE* f, tree t, enum type_code code)
+{
+  const char *val = TREE_VALUE (t);
+
+  if (val[0] == '"' || TYPE_CLASS (code) == type_real)
+    fprintf (f, "%s", val);
+  else if (TYPE_CLASS (code) == type_unsigned)
+    fprintf (f, "%lluULL", strtoull (val, NULL, 0));
+  else if (strtoll (val, NULL, 0) == LLONG_MIN)
+    fprintf (f, "(-%lldLL - 1)", LLONG_MAX);
+  else
+    fprintf (f, "%lldLL", strtoll (val, NULL, 0));
+}
+
+/* Print the format of printf to print the value of type CODE.  */
+static const char *
+cgen_format (enum type_code code)
+{
+  switch (TYPE_CLASS (code))
+    {
+    case type_signed:
+      return "%lld";
+    case type_unsigned:
+      return "%llu";
+    case type_real:
+      return "%.17g";
+    default:
+      return "\\\"%s\\\"";
+    }
+}
+
+/* Print the expression EXPR converted to the type expected by
+   the format of cgen_format.  */
+static void
+cgen_format_arg (FILE* f, enum type_code code, const char *expr, int i)
+{
+  switch (TYPE_CLASS (code))
+    {
+    case type_signed:
+      fprintf (f, ", (long long) ");
+      break;
+    case type_unsigned:
+      fprintf (f, ", (unsigned long long) ");
+      break;
+    case type_real:
+      fprintf (f, ", (double) ");
+      break;
+    default:
+      fprintf (f, ", ");
+      break;
+    }
+  fprintf (f, expr, i);
+}
+
+/* Generate the table and the test function of FUNCTION of MODULE.
+   Returns the number of cases in the table.  */
+static int
+cgen_function (FILE* f, tree module, tree function)
+{
+  struct tree_list_element *el, *al, *sl;
+  const char *mod = TREE_VALUE (TREE_OPERAND (module, 0));
+  const char *name = TREE_VALUE (TREE_OPERAND (function, 0));
+  tree sig = TREE_OPERAND (function, 2);
+  enum type_code ret = type_lookup (TREE_VALUE (TREE_LIST (sig)->entry));
+  enum type_code code;
+  int i, n = 0;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 1)), el)
+    n += cgen_case_p (sig, el->entry, true);
+  if (n == 0)
+    return 0;
+
+  fprintf (f, "\nextern %s %s (", TYPE_CTYPE (ret), name);
+  for (sl = TREE_LIST (sig)->next; sl != NULL; sl = sl->next)
+    fprintf (f, "%s%s", TYPE_CTYPE (type_lookup (TREE_VALUE (sl->entry))),
+	     sl->next != NULL ? ", " : "");
+  fprintf (f, "%s);\n\n", TREE_LIST (sig)->next == NULL ? "void" : "");
+
+  /* Table of the cases.  */
+  fprintf (f, "static const struct\n{\n");
+  for (sl = TREE_LIST (sig)->next, i = 0; sl != NULL; sl = sl->next)
+    fprintf (f, "  %s a%i;\n",
+	     TYPE_CTYPE (type_lookup (TREE_VALUE (sl->entry))), i++);
+  fprintf (f, "  %s expected;\n} pipo_cases_%s_%s[] =\n{\n",
+	   TYPE_CTYPE (ret), mod, name);
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 1)), el)
+    {
+      if (!cgen_case_p (sig, el->entry, false))
+	continue;
+
+      fprintf (f, "  { ");
+      for (sl = TREE_LIST (sig)->next,
+	   al = TREE_LIST (TREE_OPERAND (el->entry, 0));
+	   sl != NULL; sl = sl->next, al = al->next)
+	{
+	  cgen_literal (f, al->entry,
+			type_lookup (TREE_VALUE (sl->entry)));
+	  fprintf (f, ", ");
+	}
+      cgen_literal (f, TREE_OPERAND (el->entry, 1), ret);
+      fprintf (f, " },\n");
+    }
+  fprintf (f, "};\n\n");
+
+  /* Test function.  */
+  fprintf (f, "static int\n"
+	      "pipo_test_%s_%s (void)\n"
+	      "{\n"
+	      "  size_t i, failed = 0;\n"
+	      "  size_t n = sizeof (pipo_cases_%s_%s) "
+	      "/ sizeof (pipo_cases_%s_%s[0]);\n\n"
+	      "  for (i = 0; i < n; i++)\n"
+	      "    {\n"
+	      "      %s r = %s (", mod, name, mod, name, mod, name,
+	      TYPE_CTYPE (ret), name);
+  for (sl = TREE_LIST (sig)->next, i = 0; sl != NULL; sl = sl->next)
+    fprintf (f, "pipo_cases_%s_%s[i].a%i%s", mod, name, i++,
+	     sl->next != NULL ? ", " : "");
+  fprintf (f, ");\n"
+	      "      %s e = pipo_cases_%s_%s[i].expected;\n\n",
+	      TYPE_CTYPE (ret), mod, name);
+
+  /* Reals are equal if both are NaN, strings are compared by
+     contents.  */
+  if (TYPE_CLASS (ret) == type_real)
+    fprintf (f, "      if (r == e || (r != r && e != e))\n");
+  else if (TYPE_CLASS (ret) == type_pointer)
+    fprintf (f, "      if (r == e || (r != NULL && strcmp (r, e) == 0))\n");
+  else
+    fprintf (f, "      if (r == e)\n");
+  fprintf (f, "\tcontinue;\n\n"
+	      "      failed++;\n"
+	      "      fprintf (stderr, \"%s.%s: case %%zu (", mod, name);
+  for (sl = TREE_LIST (sig)->next; sl != NULL; sl = sl->next)
+    fprintf (f, "%s%s", cgen_format (type_lookup (TREE_VALUE (sl->entry))),
+	     sl->next != NULL ? ", " : "");
+  fprintf (f, "): %s != %s\\n\", i", cgen_format (ret), cgen_format (ret));
+  for (sl = TREE_LIST (sig)->next, i = 0; sl != NULL; sl = sl->next, i++)
+    {
+      char *expr = NULL;
+
+      code = type_lookup (TREE_VALUE (sl->entry));
+      if (-1 == asprintf (&expr, "pipo_cases_%s_%s[i].a%%i", mod, name))
+	err (EXIT_FAILURE, "asprintf failed");
+      cgen_format_arg (f, code, expr, i);
+      free (expr);
+    }
+  cgen_format_arg (f, ret, "r", 0);
+  cgen_format_arg (f, ret, "e", 0);
+  fprintf (f, ");\n"
+	      "    }\n\n"
+	      "  printf (\"%s.%s: %%zu cases, %%zu failed\\n\", n, failed);\n"
+	      "  return failed != 0;\n"
+	      "}\n", mod, name);
+  return n;
+}
+
+/* Generate the C test `FILE_test.c' for the cases with expected
+   values of all the modules.  Functions without a signature or with
+   arguments that are not numbers or strings are skipped.  */
+int
+codegen_c (char *file)
+{
+  struct tree_list_element *tl, *tll, *tlll;
+  struct output out;
+  char *filename = NULL;
+  FILE* f;
+  int n = 0, skipped = 0, errors = error_count;
+
+  if (-1 == asprintf (&filename, "%s_test.c", file))
+    err (EXIT_FAILURE, "asprintf failed");
+  f = output_open (&out, filename);
+
+  fprintf (f, "/* Test generated by PIPO.\n"
+	      "   Build with: cc %s -L.", filename);
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    fprintf (f, " -l%s", TREE_VALUE (TREE_OPERAND (tl->entry, 0)));
+  fprintf (f, " -o %s_test  */\n\n"
+	      "#include <stdio.h>\n"
+	      "#include <stdlib.h>\n"
+	      "#include <stdint.h>\n"
+	      "#include <string.h>\n", file);
+  free (filename);
+
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    DL_FOREACH (TREE_LIST (TREE_OPERAND (tl->entry, 1)), tll)
+      {
+	if (!cgen_function_p (tll->entry))
+	  {
+	    printf ("note: function `%s.%s' is skipped, its signature is "
+		    "not given or it takes pointers.\n",
+		    TREE_VALUE (TREE_OPERAND (tl->entry, 0)),
+		    TREE_VALUE (TREE_OPERAND (tll->entry, 0)));
+	    continue;
+	  }
+	n += cgen_function (f, tl->entry, tll->entry);
+	DL_FOREACH (TREE_LIST (TREE_OPERAND (tll->entry, 1)), tlll)
+	  skipped += TREE_CODE (tlll->entry) != EXPECT;
+      }
+
+  fprintf (f, "\nint\nmain (void)\n{\n  int failed = 0;\n\n");
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    DL_FOREACH (TREE_LIST (TREE_OPERAND (tl->entry, 1)), tll)
+      {
+	if (!cgen_function_p (tll->entry))
+	  continue;
+	DL_FOREACH (TREE_LIST (TREE_OPERAND (tll->entry, 1)), tlll)
+	  if (cgen_case_p (TREE_OPERAND (tll->entry, 2), tlll->entry, false))
+	    break;
+	if (tlll != NULL)
+	  fprintf (f, "  failed += pipo_test_%s_%s ();\n",
+		   TREE_VALUE (TREE_OPERAND (tl->entry, 0)),
+		   TREE_VALUE (TREE_OPERAND (tll->entry, 0)));
+      }
+  fprintf (f, "\n  printf (\"%%i functions failed\\n\", failed);\n"
+	      "  return failed != 0 ? EXIT_FAILURE : EXIT_SUCCESS;\n}\n");
+  if (output_close (&out) != 0 || error_count != errors)
+    return 1;
+
+  printf ("note: %i cases are written.\n", n);
+  if (skipped != 0)
+    printf ("note: %i cases without expected values are skipped.\n",
+	    skipped);
+  printf ("note: finished generating C code  [ok].\n");
+  return 0;
+}
@@ -0,0 +1,262 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+/* Generation of t-way covering arrays using IPOG strategy
+   (Lei et al., "IPOG: A General Strategy for T-Way Software
+   Testing").  The array is built for the first T parameters
+   exhaustively, then it is extended one parameter at a time:
+   horizontally, choosing the value of the new parameter that
+   covers most of the missing combinations for every existing row,
+   and vertically, adding rows for the combinations which are
+   still missing.  */
+
+#include <stdio.h>
+#include <err.h>
+
+#include "pipo.h"
+#include "combine.h"
+
+/* Value of a parameter which is not fixed yet.  */
+#define DONT_CARE (-1)
+
+struct rows
+{
+  int *data;
+  size_t n, size;
+  int k;
+};
+
+/* Append a row of DONT_CARE values to the array R.  */
+static int *
+rows_add (struct rows *r)
+{
+  int j, *row;
+
+  if (r->n == r->size)
+    {
+      r->size = r->size ? 2 * r->size : 64;
+      r->data = (int *) realloc (r->data, r->size * r->k * sizeof (int));
+      if (r->data == NULL)
+	err (EXIT_FAILURE, "realloc failed");
+    }
+
+  row = &r->data[r->n++ * r->k];
+  for (j = 0; j < r->k; j++)
+    row[j] = DONT_CARE;
+  return row;
+}
+
+/* Move COMBO to the next M-subset of {0 .. N-1} in lexicographic
+   order.  Returns false if COMBO is the last subset.  */
+static bool
+next_combination (int *combo, int m, int n)
+{
+  int j = m - 1;
+
+  while (j >= 0 && combo[j] == n - m + j)
+    j--;
+  if (j < 0)
+    return false;
+
+  combo[j]++;
+  for (j++; j < m; j++)
+    combo[j] = combo[j - 1] + 1;
+  return true;
+}
+
+/* Index of the combination of values of the parameters COMBO and
+   the parameter I in the row ROW.  Returns -1 if some of these
+   values are not fixed.  */
+static long
+tuple_index (const int *row, const int *combo, int m, int i,
+	     const int *sizes)
+{
+  long idx = 0;
+  int j;
+
+  for (j = 0; j < m; j++)
+    {
+      if (row[combo[j]] == DONT_CARE)
+	return -1;
+      idx = idx * sizes[combo[j]] + row[combo[j]];
+    }
+  if (row[i] == DONT_CARE)
+    return -1;
+  return idx * sizes[i] + row[i];
+}
+
+/* Mark all the combinations covered by ROW.  */
+static void
+mark_row (const int *row, const int *combos, size_t ncombos, int m, int i,
+	  const int *sizes, char **covered, size_t *uncovered)
+{
+  size_t c;
+
+  for (c = 0; c < ncombos; c++)
+    {
+      long idx = tuple_index (row, &combos[c * m], m, i, sizes);
+      if (idx >= 0 && !covered[c][idx])
+	{
+	  covered[c][idx] = 1;
+	  --*uncovered;
+	}
+    }
+}
+
+/* Build a covering array of strength T for K parameters, where
+   the parameter I takes SIZES[I] values.  Returns the array of
+   rows of K value indexes each and stores the number of rows in N.
+   The array should be freed by the caller.  */
+int *
+covering_array (int t, int k, const int *sizes, size_t *n)
+{
+  struct rows r = { NULL, 0, 0, k };
+  int i, j, m, *combo, *combos, *row;
+  size_t c, ncombos, uncovered, x;
+  char **covered;
+
+  assert (t >= 1 && k >= 1, "invalid covering array requested");
+  if (t > k)
+    t = k;
+  m = t - 1;
+
+  /* Exhaustive array for the first T parameters.  */
+  combo = (int *) calloc (t, sizeof (int));
+  do
+    {
+      row = rows_add (&r);
+      for (j = 0; j < t; j++)
+	row[j] = combo[j];
+
+      for (j = t - 1; j >= 0 && ++combo[j] == sizes[j]; j--)
+	combo[j] = 0;
+    }
+  while (j >= 0);
+  free (combo);
+
+  for (i = t; i < k; i++)
+    {
+      /* All the M-subsets of the preceding parameters.  */
+      combos = NULL;
+      ncombos = 0;
+      combo = (int *) malloc ((m + 1) * sizeof (int));
+      for (j = 0; j < m; j++)
+	combo[j] = j;
+      do
+	{
+	  combos = (int *) realloc (combos, (ncombos + 1) * (m + 1)
+					    * sizeof (int));
+	  memcpy (&combos[ncombos++ * m], combo, m * sizeof (int));
+	}
+      while (next_combination (combo, m, i));
+      free (combo);
+
+      covered = (char **) malloc (ncombos * sizeof (char *));
+      uncovered = 0;
+      for (c = 0; c < ncombos; c++)
+	{
+	  size_t size = sizes[i];
+	  for (j = 0; j < m; j++)
+	    size *= sizes[combos[c * m + j]];
+	  covered[c] = (char *) calloc (size, 1);
+	  uncovered += size;
+	}
+
+      /* Horizontal growth.  */
+      for (x = 0; x < r.n; x++)
+	{
+	  int v, best = 0;
+	  long gain, best_gain = -1;
+
+	  row = &r.data[x * k];
+	  for (v = 0; v < sizes[i]; v++)
+	    {
+	      row[i] = v;
+	      gain = 0;
+	      for (c = 0; c < ncombos; c++)
+		{
+		  long idx = tuple_index (row, &combos[c * m], m, i, sizes);
+		  gain += idx >= 0 && !covered[c][idx];
+		}
+	      if (gain > best_gain)
+		{
+		  best_gain = gain;
+		  best = v;
+		}
+	    }
+	  row[i] = best;
+	  mark_row (row, combos, ncombos, m, i, sizes, covered, &uncovered);
+	}
+
+      /* Vertical growth.  */
+      for (c = 0; c < ncombos && uncovered > 0; c++)
+	{
+	  const int *cc = &combos[c * m];
+	  size_t size = sizes[i];
+	  long idx;
+
+	  for (j = 0; j < m; j++)
+	    size *= sizes[cc[j]];
+
+	  for (idx = 0; idx < (long) size; idx++)
+	    {
+	      int vals[m + 1];
+	      long rest = idx;
+
+	      if (covered[c][idx])
+		continue;
+
+	      vals[m] = rest % sizes[i];
+	      rest /= sizes[i];
+	      for (j = m - 1; j >= 0; j--)
+		{
+		  vals[j] = rest % sizes[cc[j]];
+		  rest /= sizes[cc[j]];
+		}
+
+	      /* Reuse a row where these values are not fixed.  */
+	      for (x = 0; x < r.n; x++)
+		{
+		  row = &r.data[x * k];
+		  for (j = 0; j < m; j++)
+		    if (row[cc[j]] != DONT_CARE && row[cc[j]] != vals[j])
+		      break;
+		  if (j == m && (row[i] == DONT_CARE || row[i] == vals[m]))
+		    break;
+		}
+	      if (x == r.n)
+		row = rows_add (&r);
+
+	      for (j = 0; j < m; j++)
+		row[cc[j]] = vals[j];
+	      row[i] = vals[m];
+	      mark_row (row, combos, ncombos, m, i, sizes, covered,
+			&uncovered);
+	    }
+	}
+
+      for (c = 0; c < ncombos; c++)
+	free (covered[c]);
+      free (covered);
+      free (combos);
+    }
+
+  /* Parameters which are not fixed may take any value.  */
+  for (x = 0; x < r.n * k; x++)
+    if (r.data[x] == DONT_CARE)
+      r.data[x] = 0;
+
+  *n = r.n;
+  return r.data;
+}
@@ -0,0 +1,225 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+/* Removal of repeated cases of a function.  Every case is written
+   in a normal form, where numbers are printed in decimal and types
+   by their canonical names, so `0x10', `020' and `16' give the
+   same key.  Keys are kept in an open addressing hash table and a
+   case whose key is met again is dropped.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "pipo.h"
+#include "types.h"
+#include "global.h"
+#include "dedup.h"
+
+/* Write the normal form of the value VAL to F.  */
+static void
+key_value (FILE *f, const char *val)
+{
+  enum type_code code;
+  char *end;
+  long long ll;
+  unsigned long long ull;
+  double d;
+
+  if (val[0] == '"')
+    {
+      fprintf (f, "%s", val);
+      return;
+    }
+  if ((code = type_lookup (val)) != TYPE_MAX)
+    {
+      fprintf (f, "%s", TYPE_NAME (code));
+      return;
+    }
+
+  ll = strtoll (val, &end, 0);
+  if (*end == '\0' && val[0] == '-')
+    {
+      fprintf (f, "%lld", ll);
+      return;
+    }
+  ull = strtoull (val, &end, 0);
+  if (*end == '\0')
+    {
+      fprintf (f, "%llu", ull);
+      return;
+    }
+  d = strtod (val, &end);
+  if (*end == '\0')
+    fprintf (f, "%a", d);
+  else
+    fprintf (f, "%s", val);
+}
+
+/* Write the normal form of the tree T to F.  */
+static void
+key_tree (FILE *f, tree t)
+{
+  struct tree_list_element *el;
+  int i;
+
+  if (t == NULL)
+    fprintf (f, "_");
+  else if (TREE_CODE (t) == VALUE)
+    key_value (f, TREE_VALUE (t));
+  else if (TREE_CODE (t) == LIST)
+    {
+      fprintf (f, "(");
+      DL_FOREACH (TREE_LIST (t), el)
+	{
+	  key_tree (f, el->entry);
+	  if (el->next != NULL)
+	    fprintf (f, ",");
+	}
+      fprintf (f, ")");
+    }
+  else
+    {
+      fprintf (f, "%s(", TREE_CODE_NAME (TREE_CODE (t)));
+      for (i = 0; i < TREE_CODE_OPERANDS (TREE_CODE (t)); i++)
+	{
+	  key_tree (f, TREE_OPERAND (t, i));
+	  if (i + 1 < TREE_CODE_OPERANDS (TREE_CODE (t)))
+	    fprintf (f, ",");
+	}
+      fprintf (f, ")");
+    }
+}
+
+/* Normal form of the case T.  The string is allocated and must be
+   freed by the caller.  */
+char *
+case_key (tree t)
+{
+  char *key = NULL;
+  size_t size = 0;
+  FILE *f;
+
+  if ((f = open_memstream (&key, &size)) == NULL)
+    err (EXIT_FAILURE, "open_memstream failed");
+  key_tree (f, t);
+  fclose (f);
+  return key;
+}
+
+static unsigned long
+key_hash (const char *key)
+{
+  /* FNV-1a.  */
+  unsigned long h = 2166136261UL;
+
+  while (*key != '\0')
+    h = (h ^ (unsigned char) *key++) * 16777619UL;
+  return h;
+}
+
+/* Remove repeated elements of the list of cases CASES keeping the
+   first occurrence.  Returns the number of removed cases.  */
+int
+dedup_cases (tree cases)
+{
+  struct tree_list_element *el, *tmp;
+  size_t size = 16, n = 0, i;
+  char **keys, *key;
+  int removed = 0;
+
+  if ((keys = (char **) calloc (size, sizeof (char *))) == NULL)
+    err (EXIT_FAILURE, "calloc failed");
+
+  DL_FOREACH_SAFE (TREE_LIST (cases), el, tmp)
+    {
+      key = case_key (el->entry);
+      for (i = key_hash (key) & (size - 1); keys[i] != NULL;
+	   i = (i + 1) & (size - 1))
+	if (strcmp (keys[i], key) == 0)
+	  break;
+
+      if (keys[i] != NULL)
+	{
+	  DL_DELETE (TREE_LIST (cases), el);
+	  free_tree (el->entry);
+	  free (el);
+	  free (key);
+	  removed++;
+	  continue;
+	}
+      keys[i] = key;
+
+      /* Keep the table at most half full.  */
+      if (++n * 2 > size)
+	{
+	  char **old = keys;
+	  size_t j;
+
+	  if ((keys = (char **) calloc (size * 2, sizeof (char *))) == NULL)
+	    err (EXIT_FAILURE, "calloc failed");
+	  for (j = 0; j < size; j++)
+	    if (old[j] != NULL)
+	      {
+		for (i = key_hash (old[j]) & (size * 2 - 1); keys[i] != NULL;
+		     i = (i + 1) & (size * 2 - 1))
+		  ;
+		keys[i] = old[j];
+	      }
+	  free (old);
+	  size *= 2;
+	}
+    }
+
+  for (i = 0; i < size; i++)
+    free (keys[i]);
+  free (keys);
+  return removed;
+}
+
+/* Append the cases of the function FROM to the function TO, which
+   has the same name, and free FROM.  The signature of FROM is used
+   if TO has none, the attributes of FROM which TO does not have are
+   added to it.  */
+void
+merge_function (tree to, tree from)
+{
+  struct tree_list_element *el, *tmp;
+
+  if (TREE_OPERAND (to, 2) == NULL)
+    {
+      TREE_OPERAND_SET (to, 2, TREE_OPERAND (from, 2));
+      TREE_OPERAND_SET (from, 2, NULL);
+    }
+
+  if (TREE_OPERAND (to, 3) == NULL)
+    {
+      TREE_OPERAND_SET (to, 3, TREE_OPERAND (from, 3));
+      TREE_OPERAND_SET (from, 3, NULL);
+    }
+  else if (TREE_OPERAND (from, 3) != NULL)
+    DL_FOREACH_SAFE (TREE_LIST (TREE_OPERAND (from, 3)), el, tmp)
+      if (!function_attribute_p (to, TREE_VALUE (el->entry)))
+	{
+	  DL_DELETE (TREE_LIST (TREE_OPERAND (from, 3)), el);
+	  DL_APPEND (TREE_LIST (TREE_OPERAND (to, 3)), el);
+	}
+
+  DL_CONCAT (TREE_LIST (TREE_OPERAND (to, 1)),
+	     TREE_LIST (TREE_OPERAND (from, 1)));
+  TREE_LIST (TREE_OPERAND (from, 1)) = NULL;
+  free_tree (from);
+}
@@ -91,3 +91,19 @@ module_exists (tree list, const char *str)
 
   return NULL;
 }
+
+/* Check if the function FUNCTION has the attribute NAME.  */
+bool
+function_attribute_p (tree function, const char *name)
+{
+  struct tree_list_element *tl;
+
+  if (TREE_OPERAND (function, 3) == NULL)
+    return false;
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 3)), tl)
+    if (strcmp (TREE_VALUE (tl->entry), name) == 0)
+      return true;
+
+  return false;
+}
@@ -36,6 +36,7 @@ void finalize_global_tree (void);
 
 int compare_ints (const void *, const void *);
 tree module_exists (tree, const char *);
+bool function_attribute_p (tree, const char *);
 
 #endif /* __GLOBAL_H__ */
 
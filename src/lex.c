@@ -37,8 +37,8 @@ const char *token_class_name[] = {
 #undef TOKEN_CLASS
 
 /* This is a pointer to the first token from keywords.def  */
-const char **keywords = &token_kind_name[(int) tv_function];
-size_t keywords_length = tok_kind_length - tv_function;
+const char **keywords = &token_kind_name[(int) tv_blob];
+size_t keywords_length = tok_kind_length - tv_blob;
 
 static bool
 lexer_init_file (struct lexer * lex, FILE * f, const char *fname);
@@ -96,6 +96,7 @@ lexer_init_file (struct lexer * lex, FILE * f, const char *fname)
   lex->fname = fname;
   lex->file = f;
   lex->error_notifications = false;
+  lex->dotdot_pending = false;
   if (!lex->file)
     {
       warn ("error opening file `%s'", fname);
@@ -326,7 +327,7 @@ lexer_read_id (struct lexer *lex, struct token *tok,
         free (*buf);
       *size = 0;
       *buf = NULL;
-      tval_tok_init (tok, tok_keyword, (enum token_kind)(search + tv_function));
+      tval_tok_init (tok, tok_keyword, (enum token_kind)(search + tv_blob));
       return;
     }
   tok->tok_class = tok_id;
@@ -406,6 +407,16 @@ lexer_read_number (struct lexer *lex, char **buf, size_t * size, char c)
 	}
       else if (c == '.')
 	{
+	  /* `1..5' is a range, not a malformed real number.  */
+	  char cc = lexer_getch (lex);
+	  if (cc == '.')
+	    {
+	      lex->dotdot_pending = true;
+	      c = lexer_getch (lex);
+	      break;
+	    }
+	  lexer_ungetch (lex, cc);
+
 	  if (saw_dot)
 	    {
 	      if (lex->error_notifications)
@@ -445,6 +456,14 @@ lexer_get_token (struct lexer *lex)
   size_t buf_size = 16;
   char *buf = NULL;
 
+  if (lex->dotdot_pending)
+    {
+      lex->dotdot_pending = false;
+      tval_tok_init (tok, tok_operator, tv_dotdot);
+      loc = lex->loc;
+      goto return_token;
+    }
+
   c = lexer_getch (lex);
   loc = lex->loc;
   if (isspace (c))
@@ -479,6 +498,13 @@ lexer_get_token (struct lexer *lex)
 
   if (c == '.')
     {
+      char cc = lexer_getch (lex);
+      if (cc == '.')
+	{
+	  tval_tok_init (tok, tok_operator, tv_dotdot);
+	  goto return_token;
+	}
+      lexer_ungetch (lex, cc);
       tok->tok_class = lexer_read_number (lex, &buf, &buf_size, c);
       goto return_token;
     }
@@ -524,6 +550,21 @@ lexer_get_token (struct lexer *lex)
     case '}':
       tval_tok_init (tok, tok_operator, tv_rbrace);
       goto return_token;
+    case '-':
+      tval_tok_init (tok, tok_operator, tv_minus);
+      goto return_token;
+    case '=':
+      tval_tok_init (tok, tok_operator, tv_assign);
+      goto return_token;
+    case ':':
+      tval_tok_init (tok, tok_operator, tv_colon);
+      goto return_token;
+    case '[':
+      tval_tok_init (tok, tok_operator, tv_lsquare);
+      goto return_token;
+    case ']':
+      tval_tok_init (tok, tok_operator, tv_rsquare);
+      goto return_token;
     default:
       ;
     }
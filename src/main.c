@@ -17,18 +17,89 @@
 #include "global.h"
 #include "parser.h"
 #include "codegen.h"
+#include "bake.h"
+#include "run.h"
 
 #include <stdlib.h>
 #include <getopt.h>
 
 static char *progname;
 
+static struct option long_options[] =
+{
+  { "backend", required_argument, NULL, 'b' },
+  { "bake", no_argument, NULL, 'B' },
+  { "shards", required_argument, NULL, 's' },
+  { "times", required_argument, NULL, 't' },
+  { "isolate", no_argument, NULL, 'i' },
+  { "timeout", required_argument, NULL, 'T' },
+  { "memory", required_argument, NULL, 'M' },
+  { "jobs", required_argument, NULL, 'j' },
+  { "fail-fast", no_argument, NULL, 'F' },
+  { "serve", required_argument, NULL, 'S' },
+  { "connect", required_argument, NULL, 'C' },
+  { "lease", required_argument, NULL, 'L' },
+  { "help", no_argument, NULL, 'h' },
+  { NULL, 0, NULL, 0 }
+};
+
+static void
+usage (void)
+{
+  fprintf (stderr, "usage: %s [options] file.pp\n"
+		   "       %s run [options] file.pp\n"
+		   "  run                     run the cases with expected "
+		   "values without\n"
+		   "                          generating a test\n"
+		   "  -b, --backend=python|cpython|c\n"
+		   "                          generate a python unittest "
+		   "calling the libraries\n"
+		   "                          through ctypes (default) or "
+		   "through extension\n"
+		   "                          modules, or a C test of the "
+		   "cases with expected\n"
+		   "                          values\n"
+		   "  -B, --bake              compute the expected values "
+		   "by the prototypes\n"
+		   "                          while generating the test\n"
+		   "  -s, --shards=N          split the test into N files "
+		   "of similar cost\n"
+		   "  -t, --times=FILE        balance the shards by the "
+		   "times of a previous\n"
+		   "                          run written to FILE\n"
+		   "  -i, --isolate           run every batch of cases in "
+		   "a child process\n"
+		   "  -T, --timeout=MS        time limit of a case in "
+		   "isolated run\n"
+		   "  -M, --memory=MB         address space limit in "
+		   "isolated run\n"
+		   "  -j, --jobs=N            run the cases or compute the "
+		   "expected values\n"
+		   "                          by N workers, 0 for one per "
+		   "processor\n"
+		   "  -F, --fail-fast         stop the run after the first "
+		   "failure\n"
+		   "  -S, --serve=ADDR        serve the cases to workers "
+		   "on ADDR, either\n"
+		   "                          unix:PATH or HOST:PORT\n"
+		   "  -C, --connect=ADDR      check the cases served by "
+		   "the coordinator\n"
+		   "                          on ADDR\n"
+		   "  -L, --lease=S           time limit of a chunk leased "
+		   "to a worker\n"
+		   "  -h, --help              print this message\n",
+		   progname, progname);
+}
+
 #ifndef LEXER_BINARY
 int
 main (int argc, char *argv[])
 {
-  int ret = 0;
-  char *src_name = NULL;
+  int ret = 0, c, shards = 0, jobs = 1;
+  long timeout = 0, memory = 0, lease = 0;
+  bool baked = false, isolated = false, parallel = false, fast = false;
+  char *src_name = NULL, *times = NULL, *serve = NULL, *connect = NULL;
+  int (*backend) (char *) = codegen;
 
   struct lexer *lex = (struct lexer *) malloc (sizeof (struct lexer));
   struct parser *parser = (struct parser *) malloc (sizeof (struct parser));
@@ -42,7 +113,125 @@ main (int argc, char *argv[])
   else
     progname++;
 
-  argv += 1;
+  /* Cases are run by PIPO itself.  */
+  if (argc > 1 && strcmp (argv[1], "run") == 0)
+    {
+      backend = run;
+      argv++;
+      argc--;
+    }
+
+  while ((c = getopt_long (argc, argv, "b:Bs:t:iT:M:j:FS:C:L:h",
+			   long_options, NULL)) != -1)
+    switch (c)
+      {
+      case 'b':
+	if (backend == run)
+	  {
+	    fprintf (stderr, "%s:error: `run' does not generate a test\n",
+		     progname);
+	    ret = -1;
+	    goto cleanup;
+	  }
+	else if (strcmp (optarg, "python") == 0)
+	  backend = codegen;
+	else if (strcmp (optarg, "c") == 0)
+	  backend = codegen_c;
+	else if (strcmp (optarg, "cpython") == 0)
+	  backend = codegen_cpython;
+	else
+	  {
+	    fprintf (stderr, "%s:error: unknown backend `%s'\n", progname,
+		     optarg);
+	    ret = -1;
+	    goto cleanup;
+	  }
+	break;
+      case 'B':
+	baked = true;
+	break;
+      case 's':
+	shards = atoi (optarg);
+	if (shards < 1)
+	  {
+	    fprintf (stderr, "%s:error: invalid number of shards `%s'\n",
+		     progname, optarg);
+	    ret = -1;
+	    goto cleanup;
+	  }
+	break;
+      case 't':
+	times = optarg;
+	break;
+      case 'T':
+      case 'M':
+	if (c == 'T')
+	  timeout = atol (optarg);
+	else
+	  memory = atol (optarg);
+	/* Fall through.  */
+      case 'i':
+	isolated = true;
+	break;
+      case 'j':
+	jobs = atoi (optarg);
+	parallel = true;
+	break;
+      case 'F':
+	fast = true;
+	parallel = true;
+	break;
+      case 'S':
+	serve = optarg;
+	break;
+      case 'C':
+	connect = optarg;
+	break;
+      case 'L':
+	lease = atol (optarg);
+	break;
+      default:
+	usage ();
+	ret = c == 'h' ? 0 : -1;
+	goto cleanup;
+      }
+
+  /* Cases with expected values are checked in one C test.  */
+  if (shards != 0 && (backend == codegen_c || backend == run))
+    {
+      fprintf (stderr, "%s:error: shards are not supported by `%s'\n",
+	       progname, backend == run ? "run" : "--backend=c");
+      ret = -1;
+      goto cleanup;
+    }
+
+  /* Expected values are also computed by JOBS workers.  */
+  if ((isolated || (parallel && !baked) || serve || connect)
+      && backend != run)
+    {
+      fprintf (stderr, "%s:error: `--%s' is supported by `run' only\n",
+	       progname, isolated ? "isolate" : parallel ? "jobs"
+	       : serve ? "serve" : "connect");
+      ret = -1;
+      goto cleanup;
+    }
+  if (serve && connect)
+    {
+      fprintf (stderr, "%s:error: `--serve' and `--connect' are "
+	       "exclusive\n", progname);
+      ret = -1;
+      goto cleanup;
+    }
+  if (isolated)
+    run_isolate (timeout, memory);
+  if (parallel)
+    run_parallel (jobs, fast);
+  if (serve || connect)
+    run_remote (serve, connect, lease);
+  if (baked && backend == run)
+    run_bake (jobs);
+
+  argv += optind;
   /* FIXME: What if we have multiple files?  */
   if (NULL == *argv)
     {
@@ -81,8 +270,13 @@ main (int argc, char *argv[])
   /* Initialize the parser.  */
   parser_init (parser, lex);
 
-  if ((ret += parse (parser)) == 0)
-    ret += codegen (src_name);
+  /* Cases run by PIPO are baked while they are run.  */
+  if ((ret += parse (parser)) == 0 && baked && backend != run)
+    ret += bake (module_list, jobs, NULL, NULL);
+  if (ret == 0 && shards != 0)
+    ret += codegen_shards (backend, src_name, shards, times);
+  else if (ret == 0)
+    ret += backend (src_name);
 
   printf ("note: finished compiling.\n");
 
@@ -0,0 +1,511 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+/* Python workers evaluating the prototypes.  Every worker imports
+   the prototype modules once and then serves batches of cases until
+   it is stopped.  Requests and results are passed through two rings
+   per worker in one shared mapping: PIPO produces the requests and
+   the worker consumes them, the worker produces the results and PIPO
+   consumes them.  Every ring has one producer and one consumer, so
+   the positions are the only shared state and no lock is taken.
+
+   A record is its size and its identifier as two 32-bit integers
+   followed by the data, and wraps around the end of the ring.  The
+   positions, which only grow, are not in the mapping: every side
+   keeps its own, and sends the tail of the ring it produces and the
+   head of the ring it consumes to the other side through a socket
+   once a record is written or read.  The python side accesses the
+   data by plain loads and stores, which the processor may reorder;
+   passing the positions through the kernel orders them on every
+   processor.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "pipo.h"
+#include "global.h"
+#include "oracle.h"
+
+/* Size of a ring.  */
+#define ORACLE_RING (1 << 20)
+
+/* Batches given to a worker before it answers.  */
+#define ORACLE_INFLIGHT 2
+
+/* Identifier of the record which stops a worker.  */
+#define ORACLE_STOP 0xffffffffu
+
+struct oracle_ring
+{
+  unsigned char *data;
+  uint64_t tail, head;
+};
+
+struct oracle_worker
+{
+  pid_t pid;
+  struct oracle_ring req, res;
+  int sock;
+  int inflight;
+};
+
+struct oracle
+{
+  struct oracle_worker *workers;
+  int n;
+  void *mem;
+  size_t size;
+};
+
+/* Python program of a worker, started with the descriptors of the
+   mapping and of its socket, the offset of its rings, the size of a
+   ring, and the names of the modules.  A request is the
+   function, whether it is vectorized, the number of cases and the
+   class and the bits of the result type on the first line, then the
+   arguments of the cases as python tuples.  The class is `i', `u',
+   `f' or `s' for signed, unsigned, real and string types, or `-' if
+   the type is not known.  The result is a literal on its own line for
+   every case, or `-' if it cannot be baked or is not of the type.  A
+   worker exits if PIPO does.  */
+static const char *oracle_program =
+"import importlib, mmap, os, socket, struct, sys\n"
+"sys.path.insert(0, os.getcwd())\n"
+"_fd, _sock, _base, _cap = map(int, sys.argv[1:5])\n"
+"for _m in sys.argv[5:]:\n"
+"\tglobals()[_m] = importlib.import_module(_m)\n"
+"_mem = mmap.mmap(_fd, 0)\n"
+"_req, _res = _base, _base + _cap\n"
+"_sock = socket.socket(fileno=_sock)\n"
+"_sock.settimeout(1)\n"
+"_parent = os.getppid()\n"
+"_pos = [0, 0]\n"
+"def _pipo_recv():\n"
+"\twhile True:\n"
+"\t\ttry:\n"
+"\t\t\tmsg = _sock.recv(16)\n"
+"\t\t\tbreak\n"
+"\t\texcept socket.timeout:\n"
+"\t\t\tif os.getppid() != _parent:\n"
+"\t\t\t\tsys.exit(1)\n"
+"\tif len(msg) != 16:\n"
+"\t\tsys.exit(1)\n"
+"\t_pos[:] = struct.unpack('QQ', msg)\n"
+"def _pipo_read(ring, pos, n):\n"
+"\tpos = pos % _cap\n"
+"\tif pos + n <= _cap:\n"
+"\t\treturn _mem[ring + pos:ring + pos + n]\n"
+"\treturn _mem[ring + pos:ring + _cap] + _mem[ring:ring + n - (_cap - pos)]\n"
+"def _pipo_write(ring, pos, data):\n"
+"\tpos = pos % _cap\n"
+"\tk = min(len(data), _cap - pos)\n"
+"\t_mem[ring + pos:ring + pos + k] = data[:k]\n"
+"\t_mem[ring:ring + len(data) - k] = data[k:]\n"
+"def _pipo_call(f, cases, vectorized):\n"
+"\tif vectorized:\n"
+"\t\ttry:\n"
+"\t\t\treturn list(f(*map(list, zip(*cases))))\n"
+"\t\texcept Exception:\n"
+"\t\t\treturn [None] * len(cases)\n"
+"\tresults = []\n"
+"\tfor args in cases:\n"
+"\t\ttry:\n"
+"\t\t\tresults.append(f(*args))\n"
+"\t\texcept Exception:\n"
+"\t\t\tresults.append(None)\n"
+"\treturn results\n"
+"def _pipo_literal(r, kind, bits):\n"
+"\tif type(r) is bool:\n"
+"\t\tr = int(r)\n"
+"\tif type(r) is int and kind == 'f' and abs(r) <= 2 ** 53:\n"
+"\t\tr = float(r)\n"
+"\tlo, hi = {'i': (-2 ** (bits - 1), 2 ** (bits - 1)), 'u': (0, 2 ** bits),\n"
+"\t\t  '-': (-2 ** 63, 2 ** 64)}.get(kind, (0, 0))\n"
+"\tif type(r) is int and lo <= r < hi:\n"
+"\t\treturn str(r)\n"
+"\tbig = 3.4028234663852886e38 if bits == 32 else sys.float_info.max\n"
+"\tif type(r) is float and kind in 'f-' and abs(r) <= big:\n"
+"\t\treturn repr(r)\n"
+"\tif type(r) is str and kind in 's-' and r.isascii() and r.isprintable() \\\n"
+"\t   and '\"' not in r and '\\\\' not in r:\n"
+"\t\treturn '\"' + r + '\"'\n"
+"\treturn '-'\n"
+"def _pipo_eval(request):\n"
+"\tname, vectorized, n, kind, bits = request[0].split()\n"
+"\tn, bits = int(n), int(bits)\n"
+"\ttry:\n"
+"\t\tresults = _pipo_call(eval(name), eval('(' + request[1] + ')'),\n"
+"\t\t\t\t     vectorized == '1')\n"
+"\texcept Exception:\n"
+"\t\tresults = []\n"
+"\tresults = [_pipo_literal(r, kind, bits) for r in results[:n]]\n"
+"\tresults += ['-'] * (n - len(results))\n"
+"\tout = ''.join(r + '\\n' for r in results).encode()\n"
+"\treturn out if len(out) + 8 <= _cap else b'-\\n' * n\n"
+"head = tail = 0\n"
+"while True:\n"
+"\twhile _pos[0] == head:\n"
+"\t\t_pipo_recv()\n"
+"\tsize, ident = struct.unpack('II', _pipo_read(_req, head, 8))\n"
+"\trequest = _pipo_read(_req, head + 8, size).decode().split('\\n', 1)\n"
+"\thead += 8 + size\n"
+"\tif ident == 0xffffffff:\n"
+"\t\tbreak\n"
+"\tout = _pipo_eval(request)\n"
+"\tout = struct.pack('II', len(out), ident) + out\n"
+"\twhile _cap - (tail - _pos[1]) < len(out):\n"
+"\t\t_pipo_recv()\n"
+"\t_pipo_write(_res, tail, out)\n"
+"\ttail += len(out)\n"
+"\t_sock.send(struct.pack('QQ', tail, head))\n";
+
+/* Copy the record of SIZE bytes of DATA with the identifier ID to the
+   ring R.  Returns false if there is no room for it.  */
+static bool
+oracle_put (struct oracle_ring *r, uint32_t id, const char *data,
+	    uint32_t size)
+{
+  unsigned char *d = r->data;
+  uint64_t tail = r->tail;
+  uint32_t hdr[2];
+  size_t pos, k, i;
+
+  if (ORACLE_RING - (tail - r->head) < sizeof (hdr) + size)
+    return false;
+  hdr[0] = size;
+  hdr[1] = id;
+  for (i = 0; i < 2; i++)
+    {
+      const char *src = i == 0 ? (const char *) hdr : data;
+      size_t n = i == 0 ? sizeof (hdr) : size;
+
+      pos = tail % ORACLE_RING;
+      k = n < ORACLE_RING - pos ? n : ORACLE_RING - pos;
+      memcpy (d + pos, src, k);
+      memcpy (d, src + k, n - k);
+      tail += n;
+    }
+  r->tail = tail;
+  return true;
+}
+
+/* Take the next record from the ring R.  Its data is returned in a
+   new buffer of SIZE bytes, and its identifier in ID.  Returns NULL
+   if the ring is empty.  */
+static char *
+oracle_get (struct oracle_ring *r, uint32_t *id, size_t *size)
+{
+  unsigned char *d = r->data;
+  uint64_t head = r->head;
+  uint32_t hdr[2];
+  char *buf = NULL;
+  size_t pos, k, i, n;
+
+  if (r->tail == head)
+    return NULL;
+  for (i = 0; i < 2; i++)
+    {
+      char *dst = i == 0 ? (char *) hdr : buf;
+
+      n = i == 0 ? sizeof (hdr) : hdr[0];
+      if (i == 1 && (dst = buf = malloc (n + 1)) == NULL)
+	err (EXIT_FAILURE, "malloc failed");
+      pos = head % ORACLE_RING;
+      k = n < ORACLE_RING - pos ? n : ORACLE_RING - pos;
+      memcpy (dst, d + pos, k);
+      memcpy (dst + k, d, n - k);
+      head += n;
+    }
+  r->head = head;
+  buf[hdr[0]] = '\0';
+  *id = hdr[1];
+  *size = hdr[0];
+  return buf;
+}
+
+/* Send the positions of PIPO in the rings of the worker W.  A worker
+   which has exited is found by oracle_dead_p, so a failure is
+   ignored.  */
+static void
+oracle_send (struct oracle_worker *w)
+{
+  uint64_t msg[2] = { w->req.tail, w->res.head };
+
+  while (send (w->sock, msg, sizeof (msg), MSG_NOSIGNAL) == -1
+	 && errno == EINTR)
+    ;
+}
+
+/* Take the positions the worker W has sent, the last ones being the
+   current.  */
+static void
+oracle_recv (struct oracle_worker *w)
+{
+  uint64_t msg[2];
+
+  while (recv (w->sock, msg, sizeof (msg), MSG_DONTWAIT) == sizeof (msg))
+    {
+      w->res.tail = msg[0];
+      w->req.head = msg[1];
+    }
+}
+
+/* Sleep a little longer every time nothing happens, counted by
+   IDLE.  */
+static void
+oracle_wait (int *idle)
+{
+  struct timespec ts = { 0, 0 };
+
+  if (++*idle > 100)
+    {
+      ts.tv_nsec = (*idle - 100 < 1000 ? *idle - 100 : 1000) * 1000L;
+      nanosleep (&ts, NULL);
+    }
+}
+
+/* Start N workers evaluating the prototypes of the modules MODULES,
+   or one per processor if N is 0.  The python interpreter is taken
+   from PIPO_PYTHON environment variable, `python3' by default.
+   Returns NULL on error.  */
+struct oracle *
+oracle_open (tree modules, int n)
+{
+  struct tree_list_element *tl;
+  char tmpl[] = "/dev/shm/pipo-oracle-XXXXXX";
+  const char *python = getenv ("PIPO_PYTHON");
+  char args[4][32];
+  const char **argv;
+  struct oracle *o;
+  long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  size_t ring = ORACLE_RING;
+  int fd, sv[2], i, argc = 7;
+
+  if (n <= 0)
+    n = cpus > 0 ? cpus : 1;
+  if ((o = calloc (1, sizeof (struct oracle))) == NULL
+      || (o->workers = calloc (n, sizeof (struct oracle_worker))) == NULL)
+    err (EXIT_FAILURE, "calloc failed");
+
+  /* The mapping is not named once the workers are started.  */
+  if ((fd = mkstemp (tmpl)) == -1)
+    {
+      strcpy (tmpl, "/tmp/pipo-oracle-XXXXXX");
+      fd = mkstemp (tmpl);
+    }
+  o->size = 2 * ring * n;
+  if (fd == -1 || ftruncate (fd, o->size) == -1
+      || (o->mem = mmap (NULL, o->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fd, 0)) == MAP_FAILED)
+    {
+      warn ("cannot map `%s'", tmpl);
+      if (fd != -1)
+	{
+	  unlink (tmpl);
+	  close (fd);
+	}
+      free (o->workers);
+      free (o);
+      return NULL;
+    }
+
+  DL_FOREACH (TREE_LIST (modules), tl)
+    argc++;
+  if ((argv = calloc (argc + 1, sizeof (char *))) == NULL)
+    err (EXIT_FAILURE, "calloc failed");
+  argv[0] = python ? python : "python3";
+  argv[1] = "-c";
+  argv[2] = oracle_program;
+  argv[3] = args[0];
+  argv[6] = args[3];
+  argc = 7;
+  DL_FOREACH (TREE_LIST (modules), tl)
+    argv[argc++] = TREE_VALUE (TREE_OPERAND (tl->entry, 0));
+  snprintf (args[0], sizeof (args[0]), "%i", fd);
+  snprintf (args[3], sizeof (args[3]), "%i", ORACLE_RING);
+
+  fflush (stdout);
+  for (i = 0; i < n; i++)
+    {
+      struct oracle_worker *w = &o->workers[i];
+
+      w->req.data = (unsigned char *) o->mem + 2 * ring * i;
+      w->res.data = w->req.data + ring;
+      if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+	err (EXIT_FAILURE, "socketpair failed");
+      w->sock = sv[0];
+      snprintf (args[1], sizeof (args[1]), "%zu", 2 * ring * i);
+      snprintf (args[2], sizeof (args[2]), "%i", sv[1]);
+      argv[4] = args[2];
+      argv[5] = args[1];
+      if ((w->pid = fork ()) == -1)
+	err (EXIT_FAILURE, "fork failed");
+      if (w->pid == 0)
+	{
+	  fcntl (sv[1], F_SETFD, 0);
+	  execvp (argv[0], (char *const *) argv);
+	  warn ("cannot run `%s'", argv[0]);
+	  _exit (127);
+	}
+      close (sv[1]);
+    }
+  o->n = n;
+  unlink (tmpl);
+  close (fd);
+  free (argv);
+  return o;
+}
+
+/* Check if a worker of O has exited, and report it.  */
+static bool
+oracle_dead_p (struct oracle *o)
+{
+  int i, status;
+
+  for (i = 0; i < o->n; i++)
+    if (o->workers[i].pid > 0
+	&& waitpid (o->workers[i].pid, &status, WNOHANG) == o->workers[i].pid)
+      {
+	o->workers[i].pid = -1;
+	fprintf (stderr, "error: prototype worker %i %s %i\n", i,
+		 WIFSIGNALED (status) ? "is killed by signal"
+		 : "exited with status",
+		 WIFSIGNALED (status) ? WTERMSIG (status)
+		 : WEXITSTATUS (status));
+	return true;
+      }
+  return false;
+}
+
+/* Evaluate the N batches BATCHES by the workers of O, keeping every
+   worker busy.  Unless READY is NULL, it is called with the index of
+   every batch and DATA in the order of the batches, as soon as the
+   batch and all the previous ones are evaluated; the workers go on
+   with the batches given to them meanwhile.  Returns non-zero if a
+   worker failed, in which case all of them are stopped.  */
+int
+oracle_eval (struct oracle *o, struct oracle_batch *batches, size_t n,
+	     void (*ready) (size_t, void *), void *data)
+{
+  size_t next = 0, first = 0, size;
+  bool progress;
+  uint32_t id;
+  char *buf, *finished;
+  int i, idle = 0;
+
+  if ((finished = calloc (n + 1, 1)) == NULL)
+    err (EXIT_FAILURE, "calloc failed");
+  while (first < n)
+    {
+      progress = false;
+      for (i = 0; i < o->n; i++)
+	{
+	  struct oracle_worker *w = &o->workers[i];
+	  bool moved = false;
+
+	  oracle_recv (w);
+
+	  /* A batch without a request or which does not fit in a ring
+	     has no result.  */
+	  while (next < n
+		 && (batches[next].request == NULL
+		     || batches[next].size + 2 * sizeof (uint32_t)
+			> ORACLE_RING))
+	    finished[next++] = true, progress = true;
+	  if (next < n && w->inflight < ORACLE_INFLIGHT
+	      && oracle_put (&w->req, next, batches[next].request,
+			     batches[next].size))
+	    {
+	      next++;
+	      w->inflight++;
+	      progress = moved = true;
+	    }
+	  while ((buf = oracle_get (&w->res, &id, &size)) != NULL)
+	    {
+	      batches[id].result = buf;
+	      batches[id].rsize = size;
+	      finished[id] = true;
+	      w->inflight--;
+	      progress = moved = true;
+	    }
+	  if (moved)
+	    oracle_send (w);
+	}
+
+      for (; first < n && finished[first]; first++)
+	if (ready != NULL)
+	  ready (first, data);
+
+      if (progress)
+	idle = 0;
+      else if (oracle_dead_p (o))
+	{
+	  for (i = 0; i < o->n; i++)
+	    if (o->workers[i].pid > 0)
+	      kill (o->workers[i].pid, SIGTERM);
+	  free (finished);
+	  return 1;
+	}
+      else
+	oracle_wait (&idle);
+    }
+  free (finished);
+  return 0;
+}
+
+/* Stop the workers of O and free it.  Returns non-zero if a worker
+   failed.  */
+int
+oracle_close (struct oracle *o)
+{
+  int i, status, idle, ret = 0;
+
+  for (i = 0; i < o->n; i++)
+    {
+      if (o->workers[i].pid <= 0)
+	continue;
+      idle = 0;
+      while (oracle_recv (&o->workers[i]),
+	     !oracle_put (&o->workers[i].req, ORACLE_STOP, "", 0))
+	oracle_wait (&idle);
+      oracle_send (&o->workers[i]);
+    }
+  for (i = 0; i < o->n; i++)
+    if (o->workers[i].pid > 0)
+      {
+	while (waitpid (o->workers[i].pid, &status, 0) == -1
+	       && errno == EINTR)
+	  ;
+	ret |= !WIFEXITED (status) || WEXITSTATUS (status) != 0;
+      }
+    else if (o->workers[i].pid == -1)
+      ret = 1;
+  for (i = 0; i < o->n; i++)
+    close (o->workers[i].sock);
+  munmap (o->mem, o->size);
+  free (o->workers);
+  free (o);
+  return ret;
+}
@@ -0,0 +1,41 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+#ifndef __ORACLE_H__
+#define __ORACLE_H__
+
+#include <stddef.h>
+#include "tree.h"
+
+/* A batch of cases evaluated by the prototype.  The request is passed
+   to a worker as is, and its result is set once the worker answers;
+   it stays NULL if the batch has no request or does not fit in the
+   rings.  */
+struct oracle_batch
+{
+  char *request;
+  size_t size;
+  char *result;
+  size_t rsize;
+};
+
+struct oracle;
+
+struct oracle *oracle_open (tree, int);
+int oracle_eval (struct oracle *, struct oracle_batch *, size_t,
+		 void (*) (size_t, void *), void *);
+int oracle_close (struct oracle *);
+
+#endif /* __ORACLE_H__ */
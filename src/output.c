@@ -0,0 +1,124 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+/* Generated files are written to memory first.  A file is replaced
+   only if the new contents differ, through a temporary file renamed
+   over it, so the modification times of unchanged files are kept and
+   a reader never sees a partially written file.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "output.h"
+
+/* Start the output of the file PATH into the buffer of OUT.  Returns
+   the stream to write the contents to.  */
+FILE *
+output_open (struct output *out, const char *path)
+{
+  out->buf = NULL;
+  out->size = 0;
+  if ((out->path = strdup (path)) == NULL)
+    err (EXIT_FAILURE, "strdup failed");
+  if ((out->f = open_memstream (&out->buf, &out->size)) == NULL)
+    err (EXIT_FAILURE, "open_memstream failed");
+  return out->f;
+}
+
+/* Check if the file PATH has SIZE bytes equal to BUF.  */
+static bool
+output_same_p (const char *path, const char *buf, size_t size)
+{
+  struct stat st;
+  char *old;
+  bool same;
+  FILE *f;
+
+  if (stat (path, &st) != 0 || (size_t) st.st_size != size)
+    return false;
+  if ((f = fopen (path, "r")) == NULL)
+    return false;
+  if ((old = malloc (size + 1)) == NULL)
+    err (EXIT_FAILURE, "malloc failed");
+  same = fread (old, 1, size, f) == size && memcmp (old, buf, size) == 0;
+  free (old);
+  fclose (f);
+  return same;
+}
+
+/* Finish the output OUT and write it to its file if the contents
+   changed.  Returns non-zero on error.  */
+int
+output_close (struct output *out)
+{
+  char *tmp = NULL;
+  int fd, ret = 0;
+  size_t done = 0;
+  ssize_t n;
+
+  fclose (out->f);
+  if (output_same_p (out->path, out->buf, out->size))
+    goto cleanup;
+
+  if (-1 == asprintf (&tmp, "%s.tmp%ld", out->path, (long) getpid ()))
+    err (EXIT_FAILURE, "asprintf failed");
+  if ((fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+    {
+      fprintf (stderr, "Can't open file `%s' for writing", tmp);
+      ret = 1;
+      goto cleanup;
+    }
+  while (done < out->size
+	 && (n = write (fd, out->buf + done, out->size - done)) > 0)
+    done += n;
+  if (close (fd) != 0 || done != out->size
+      || rename (tmp, out->path) != 0)
+    {
+      warn ("cannot write `%s'", out->path);
+      unlink (tmp);
+      ret = 1;
+    }
+
+cleanup:
+  free (tmp);
+  free (out->buf);
+  free (out->path);
+  return ret;
+}
+
+/* Check if the first line of the file PATH is STAMP.  */
+bool
+output_stamp_p (const char *path, const char *stamp)
+{
+  size_t len = strlen (stamp);
+  char *line;
+  bool same;
+  FILE *f;
+
+  if ((f = fopen (path, "r")) == NULL)
+    return false;
+  if ((line = malloc (len + 2)) == NULL)
+    err (EXIT_FAILURE, "malloc failed");
+  same = fgets (line, len + 2, f) != NULL && strncmp (line, stamp, len) == 0
+	 && line[len] == '\n';
+  free (line);
+  fclose (f);
+  return same;
+}
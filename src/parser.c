@@ -19,6 +19,9 @@
 #include "tree.h"
 #include "global.h"
 #include "parser.h"
+#include "types.h"
+#include "combine.h"
+#include "dedup.h"
 
 static struct token *parser_get_token (struct parser *);
 static void parser_unget (struct parser *);
@@ -73,6 +76,12 @@ parser_get_lexer_token (struct parser *parser)
 	  case tv_rbrace:
 	    parser->brace_count--;
 	    break;
+	  case tv_lsquare:
+	    parser->square_count++;
+	    break;
+	  case tv_rsquare:
+	    parser->square_count--;
+	    break;
 	  default:
 	    ;
 	  }
@@ -233,61 +242,584 @@ static tree
 handle_list (struct parser * parser, tree (*handler) (struct parser *),
 	     enum token_kind delim)
 {
-  tree ret;
+  tree list = make_tree_list ();
   tree t;
-  t = handler (parser);
+
+  /* An erroneous element is skipped, so that the rest of the
+     list is still checked.  */
+  do
+    {
+      t = handler (parser);
+      if (t != NULL && t != error_mark_node)
+	tree_list_append (list, t);
+    }
+  while (token_is_operator (parser_get_token (parser), delim));
+  parser_unget (parser);
+
+  return list;
+}
+
+/* Read a literal, which may be a number preceded by a minus sign.
+   The token class of the literal is stored in CLS.  */
+static tree
+handle_literal (struct parser *parser, enum token_class *cls)
+{
+  struct token *tok = parser_get_token (parser);
+  char *neg = NULL;
+  tree t;
+
+  if (!token_is_operator (tok, tv_minus))
+    {
+      *cls = token_class (tok);
+      return make_value_tok (tok);
+    }
+
+  tok = parser_get_token (parser);
+  *cls = token_class (tok);
+  if (!token_is_number (tok))
+    {
+      error_loc (token_location (tok), "number expected after `-', "
+		 "`%s' found", token_as_string (tok));
+      return error_mark_node;
+    }
+
+  if (-1 == asprintf (&neg, "-%s", token_as_string (tok)))
+    err (EXIT_FAILURE, "asprintf failed");
+  t = make_value_str (neg);
+  TREE_LOCATION (t) = token_location (tok);
+  free (neg);
+  return t;
+}
+
+/* Read an integer bound of the range.  Returns NULL and reports
+   an error if the literal is not an integer.  */
+static tree
+handle_range_bound (struct parser *parser)
+{
+  enum token_class cls;
+  tree t = handle_literal (parser, &cls);
+
   if (t == error_mark_node)
-    return t;
+    return NULL;
+
+  if (cls != tok_intnum && cls != tok_octnum && cls != tok_hexnum)
+    {
+      error_loc (TREE_LOCATION (t), "integer expected in range, "
+		 "`%s' found", TREE_VALUE (t));
+      free_tree (t);
+      return NULL;
+    }
+  return t;
+}
+
+/* Parse the rest of the range `START .. END [step STEP]'.  START
+   has been read already.  The range is kept as a RANGE node
+   and it is never expanded by the parser.  */
+static tree
+handle_range (struct parser *parser, tree start, enum token_class cls)
+{
+  tree range, t;
 
-  if (!token_is_operator (parser_get_token (parser), delim))
+  range = make_tree (RANGE);
+  TREE_LOCATION (range) = TREE_LOCATION (start);
+  TREE_OPERAND_SET (range, 0, start);
+  if (cls != tok_intnum && cls != tok_octnum && cls != tok_hexnum)
     {
-      ret = make_tree_list ();
-      tree_list_append (ret, t);
+      error_loc (TREE_LOCATION (start), "integer expected in range, "
+		 "`%s' found", TREE_VALUE (start));
+      goto error;
+    }
+
+  if ((t = handle_range_bound (parser)) == NULL)
+    goto error;
+  TREE_OPERAND_SET (range, 1, t);
+
+  if (token_is_keyword (parser_get_token (parser), tv_step))
+    {
+      if ((t = handle_range_bound (parser)) == NULL)
+	goto error;
+      TREE_OPERAND_SET (range, 2, t);
+      if (strtoll (TREE_VALUE (t), NULL, 0) <= 0)
+	{
+	  error_loc (TREE_LOCATION (t), "range step must be positive");
+	  goto error;
+	}
     }
   else
     {
-      tree list = make_tree_list ();
-      tree_list_append (list, t);
-      while (true)
+      parser_unget (parser);
+      TREE_OPERAND_SET (range, 2, make_value_str ("1"));
+    }
+
+  return range;
+error:
+  free_tree (range);
+  return error_mark_node;
+}
+
+/* Check that the bound VAL of the random generator fits into the
+   type CODE and replace it with a canonical decimal form.  */
+static bool
+random_bound_normalize (tree val, enum token_class cls,
+			enum type_code code)
+{
+  char *min, *max, *str = NULL;
+  const char *v = TREE_VALUE (val);
+  bool ret = true;
+  int r;
+
+  type_bounds (code, &min, &max);
+  if (TYPE_CLASS (code) == type_real)
+    {
+      r = asprintf (&str, "%.17g", strtod (v, NULL));
+      if (r != -1 && strpbrk (str, ".en") == NULL)
 	{
-	  t = handler (parser);
+	  free (str);
+	  r = asprintf (&str, "%.17g.0", strtod (v, NULL));
+	}
+    }
+  else if (cls == tok_realnum
+	   && strtod (v, NULL) != (long long) strtod (v, NULL))
+    {
+      error_loc (TREE_LOCATION (val), "`%s' is not an integer", v);
+      ret = false;
+      goto out;
+    }
+  else if (TYPE_CLASS (code) == type_signed)
+    {
+      long long x = cls == tok_realnum ? (long long) strtod (v, NULL)
+				       : strtoll (v, NULL, 0);
+      ret = strtoll (min, NULL, 10) <= x && x <= strtoll (max, NULL, 10);
+      r = asprintf (&str, "%lld", x);
+    }
+  else
+    {
+      unsigned long long x = cls == tok_realnum
+			     ? (unsigned long long) strtod (v, NULL)
+			     : strtoull (v, NULL, 0);
+      ret = v[0] != '-' && x <= strtoull (max, NULL, 10);
+      r = asprintf (&str, "%llu", x);
+    }
 
-	  if (t != NULL && t != error_mark_node)
-	    tree_list_append (list, t);
-	  if (!token_is_operator (parser_get_token (parser), delim))
+  if (r == -1)
+    err (EXIT_FAILURE, "asprintf failed");
+  if (!ret)
+    error_loc (TREE_LOCATION (val), "`%s' does not fit into `%s'",
+	       v, TYPE_NAME (code));
+  free (TREE_VALUE (val));
+  TREE_VALUE (val) = str;
+  TREE_VALUE_LENGTH (val) = strlen (str);
+out:
+  free (min);
+  free (max);
+  return ret;
+}
+
+/* Parse the random generator
+     random (TYPE [, NUM [, NUM [, NUM]]] [, seed = INT] [, dist = ID])
+   One number is the count of cases, two numbers are the bounds of
+   the values and three numbers are the count and the bounds.  The
+   keyword `random' has been read already.  */
+static tree
+handle_random (struct parser *parser, struct token *start)
+{
+  const char *dists[] = { "uniform", "loguniform", "edge" };
+  struct token *tok;
+  tree random, nums[3], t;
+  enum token_class cls[3];
+  enum type_code code;
+  char *min, *max, *str;
+  double count;
+  int n = 0, i;
+
+  random = make_tree (RANDOM);
+  TREE_LOCATION (random) = token_location (start);
+
+  if (!parser_forward_tval (parser, tv_lparen))
+    goto error;
+
+  tok = parser_get_token (parser);
+  if (token_class (tok) != tok_id
+      || !TYPE_IS_NUMBER (code = type_lookup (token_as_string (tok))))
+    {
+      error_loc (token_location (tok), "type expected in random, "
+		 "`%s' found", token_as_string (tok));
+      goto error;
+    }
+  TREE_OPERAND_SET (random, 0, make_value_str (TYPE_NAME (code)));
+
+  while (token_is_operator (parser_get_token (parser), tv_comma))
+    {
+      tok = parser_get_token (parser);
+      if (token_class (tok) == tok_id)
+	{
+	  /* Options are given as `NAME = VALUE'.  */
+	  struct token *val;
+	  bool seed = strcmp (token_as_string (tok), "seed") == 0;
+	  bool dist = strcmp (token_as_string (tok), "dist") == 0;
+
+	  if (!parser_forward_tval (parser, tv_assign))
+	    goto error;
+	  val = parser_get_token (parser);
+	  if (seed && token_is_integer (val))
+	    {
+	      if (-1 == asprintf (&str, "%llu",
+				  strtoull (token_as_string (val), NULL, 0)))
+		err (EXIT_FAILURE, "asprintf failed");
+	      TREE_OPERAND_SET (random, 4, make_value_str (str));
+	      free (str);
+	      continue;
+	    }
+	  for (i = 0; dist && i < 3; i++)
+	    if (token_class (val) == tok_id
+		&& strcmp (token_as_string (val), dists[i]) == 0)
+	      break;
+	  if (!dist || i == 3)
+	    {
+	      error_loc (token_location (val), "invalid value `%s' of "
+			 "random option", token_as_string (val));
+	      goto error;
+	    }
+	  TREE_OPERAND_SET (random, 5, make_value_tok (val));
+	}
+      else if (n == 3)
+	{
+	  error_loc (token_location (tok), "too many numbers in random");
+	  goto error;
+	}
+      else
+	{
+	  parser_unget (parser);
+	  t = handle_literal (parser, &cls[n]);
+	  if (t == error_mark_node)
+	    goto error;
+	  nums[n++] = t;
+	  if (!token_is_number (tok) && !token_is_operator (tok, tv_minus))
 	    {
-	      parser_unget (parser);
-	      return list;
+	      error_loc (TREE_LOCATION (t), "number expected in random, "
+			 "`%s' found", TREE_VALUE (t));
+	      goto error;
 	    }
 	}
-      ret = list;
     }
   parser_unget (parser);
 
-  return ret;
+  if (!parser_forward_tval (parser, tv_rparen))
+    goto error;
+
+  /* Count of cases.  */
+  if (n % 2 == 1)
+    {
+      /* The count is checked against the range of the conversion
+	 before it is converted.  */
+      count = strtod (TREE_VALUE (nums[0]), NULL);
+      if (count < 1 || count >= 0x1p64
+	  || count != (unsigned long long) count)
+	{
+	  error_loc (TREE_LOCATION (nums[0]), "count of random cases "
+		     "must be a positive integer");
+	  goto invalid;
+	}
+      free_tree (nums[0]);
+      nums[0] = NULL;
+    }
+  else
+    count = 1000;
+  if (-1 == asprintf (&str, "%llu", (unsigned long long) count))
+    err (EXIT_FAILURE, "asprintf failed");
+  TREE_OPERAND_SET (random, 1, make_value_str (str));
+  free (str);
+
+  /* Bounds of the values.  */
+  if (n >= 2)
+    {
+      for (i = n - 2; i < n; i++)
+	{
+	  TREE_OPERAND_SET (random, 2 + i - (n - 2), nums[i]);
+	  t = nums[i];
+	  nums[i] = NULL;
+	  if (!random_bound_normalize (t, cls[i], code))
+	    goto invalid;
+	}
+      const char *lo = TREE_VALUE (TREE_OPERAND (random, 2));
+      const char *hi = TREE_VALUE (TREE_OPERAND (random, 3));
+      bool empty;
+
+      if (TYPE_CLASS (code) == type_signed)
+	empty = strtoll (lo, NULL, 10) > strtoll (hi, NULL, 10);
+      else if (TYPE_CLASS (code) == type_unsigned)
+	empty = strtoull (lo, NULL, 10) > strtoull (hi, NULL, 10);
+      else
+	empty = strtod (lo, NULL) > strtod (hi, NULL);
+
+      if (empty)
+	{
+	  error_loc (TREE_LOCATION (random), "empty range of random values");
+	  goto invalid;
+	}
+    }
+  else
+    {
+      type_bounds (code, &min, &max);
+      TREE_OPERAND_SET (random, 2, make_value_str (min));
+      TREE_OPERAND_SET (random, 3, make_value_str (max));
+      free (min);
+      free (max);
+    }
+
+  if (TREE_OPERAND (random, 4) == NULL)
+    TREE_OPERAND_SET (random, 4, make_value_str ("0"));
+  if (TREE_OPERAND (random, 5) == NULL)
+    TREE_OPERAND_SET (random, 5, make_value_str (dists[0]));
+
+  if (TYPE_CLASS (code) == type_real
+      && strcmp (TREE_VALUE (TREE_OPERAND (random, 5)), "loguniform") == 0
+      && strtod (TREE_VALUE (TREE_OPERAND (random, 2)), NULL) <= 0)
+    {
+      error_loc (TREE_LOCATION (random), "log-uniform real values "
+		 "need positive bounds");
+      goto invalid;
+    }
+
+  return random;
+error:
+  parser_get_until_tval (parser, tv_rparen);
+invalid:
+  /* The numbers not set in the tree yet are freed apart.  */
+  for (i = 0; i < n; i++)
+    free_tree (nums[i]);
+  free_tree (random);
+  return error_mark_node;
+}
+
+/* Parse the file argument
+     blob ( STRING [, INT, INT ] )
+   which is passed to the function as a pointer to the mapped
+   contents of the file and the length of the contents.  Numbers
+   are the offset and the length of the part of the file.  The
+   keyword `blob' has been read already.  */
+static tree
+handle_blob (struct parser *parser, struct token *start)
+{
+  struct token *tok;
+  tree blob = make_tree (BLOB);
+  int i;
+
+  TREE_LOCATION (blob) = token_location (start);
+  if (!parser_forward_tval (parser, tv_lparen))
+    goto error;
+
+  tok = parser_get_token (parser);
+  if (token_class (tok) != tok_string)
+    {
+      error_loc (token_location (tok), "file name expected, `%s' found",
+		 token_as_string (tok));
+      goto error;
+    }
+  TREE_OPERAND_SET (blob, 0, make_value_tok (tok));
+
+  if (token_is_operator (parser_get_token (parser), tv_comma))
+    for (i = 1; i <= 2; i++)
+      {
+	if (i == 2 && !parser_forward_tval (parser, tv_comma))
+	  goto error;
+	tok = parser_get_token (parser);
+	if (!token_is_integer (tok))
+	  {
+	    error_loc (token_location (tok), "integer expected in blob, "
+		       "`%s' found", token_as_string (tok));
+	    goto error;
+	  }
+	TREE_OPERAND_SET (blob, i, make_value_tok (tok));
+      }
+  else
+    {
+      parser_unget (parser);
+      TREE_OPERAND_SET (blob, 1, make_value_str ("0"));
+    }
+
+  if (!parser_forward_tval (parser, tv_rparen))
+    goto error;
+
+  return blob;
+error:
+  parser_get_until_tval (parser, tv_rparen);
+  free_tree (blob);
+  return error_mark_node;
+}
+
+static tree
+handle_array_value (struct parser *parser)
+{
+  struct token *tok = parser_get_token (parser);
+  enum token_class cls;
+
+  parser_unget (parser);
+  if (!token_is_number (tok) && !token_is_operator (tok, tv_minus))
+    {
+      error_loc (token_location (tok), "number expected in array, "
+		 "`%s' found", token_as_string (tok));
+      parser_get_token (parser);
+      return error_mark_node;
+    }
+  return handle_literal (parser, &cls);
+}
+
+/* Parse the array
+     TYPE [ NUM [, NUM]* ]
+   The type has been read already.  */
+static tree
+handle_array (struct parser *parser, struct token *type)
+{
+  tree array = make_tree (ARRAY);
+  enum type_code code;
+
+  TREE_LOCATION (array) = token_location (type);
+  if (!TYPE_IS_NUMBER (code = type_lookup (token_as_string (type))))
+    {
+      error_loc (token_location (type), "invalid type of array `%s'",
+		 token_as_string (type));
+      goto error;
+    }
+  TREE_OPERAND_SET (array, 0, make_value_str (TYPE_NAME (code)));
+
+  if (!parser_forward_tval (parser, tv_lsquare))
+    goto error;
+  TREE_OPERAND_SET (array, 1, handle_list (parser, handle_array_value,
+					   tv_comma));
+  if (!parser_forward_tval (parser, tv_rsquare))
+    goto error;
+
+  return array;
+error:
+  parser_get_until_tval (parser, tv_rsquare);
+  free_tree (array);
+  return error_mark_node;
+}
+
+/* Parse the output buffer
+     out ( TYPE, INT )
+   The keyword `out' has been read already.  */
+static tree
+handle_outbuf (struct parser *parser, struct token *start)
+{
+  struct token *tok;
+  tree buf = make_tree (OUTBUF);
+  enum type_code code;
+
+  TREE_LOCATION (buf) = token_location (start);
+  if (!parser_forward_tval (parser, tv_lparen))
+    goto error;
+
+  tok = parser_get_token (parser);
+  if (token_class (tok) != tok_id
+      || !TYPE_IS_NUMBER (code = type_lookup (token_as_string (tok))))
+    {
+      error_loc (token_location (tok), "type expected in output buffer, "
+		 "`%s' found", token_as_string (tok));
+      goto error;
+    }
+  TREE_OPERAND_SET (buf, 0, make_value_str (TYPE_NAME (code)));
+
+  if (!parser_forward_tval (parser, tv_comma))
+    goto error;
+  tok = parser_get_token (parser);
+  if (!token_is_integer (tok) || strtoll (token_as_string (tok), NULL, 0) <= 0)
+    {
+      error_loc (token_location (tok), "size of output buffer expected, "
+		 "`%s' found", token_as_string (tok));
+      goto error;
+    }
+  TREE_OPERAND_SET (buf, 1, make_value_tok (tok));
+
+  if (!parser_forward_tval (parser, tv_rparen))
+    goto error;
+
+  return buf;
+error:
+  parser_get_until_tval (parser, tv_rparen);
+  free_tree (buf);
+  return error_mark_node;
 }
 
 tree
 handle_value (struct parser *parser)
 {
   struct token *tok;
-  tok = parser_get_token (parser);
-  return make_value_tok (tok);
+  enum token_class cls;
+  tree t;
+
+  if (token_is_keyword (tok = parser_get_token (parser), tv_random))
+    return handle_random (parser, tok);
+  if (token_is_keyword (tok, tv_blob))
+    return handle_blob (parser, tok);
+  if (token_is_keyword (tok, tv_out))
+    return handle_outbuf (parser, tok);
+  if (token_class (tok) == tok_id
+      && token_is_operator (parser_get_token (parser), tv_lsquare))
+    {
+      parser_unget (parser);
+      return handle_array (parser, tok);
+    }
+  else if (token_class (tok) == tok_id)
+    parser_unget (parser);
+  parser_unget (parser);
+
+  t = handle_literal (parser, &cls);
+  if (t == error_mark_node)
+    return t;
+
+  if (token_is_operator (parser_get_token (parser), tv_dotdot))
+    return handle_range (parser, t, cls);
+
+  parser_unget (parser);
+  return t;
 }
 
 tree
 handle_args (struct parser *parser)
 {
+  struct tree_list_element *el;
+  const char *count = NULL;
+  struct location loc;
+  int errors = error_count;
   tree t;
 
+  loc = token_location (parser_get_token (parser));
+  parser_unget (parser);
   if (!parser_forward_tval (parser, tv_lparen))
     goto error;
 
   t = handle_list (parser, handle_value, tv_comma);
+  TREE_LOCATION (t) = loc;
 
   if (!parser_forward_tval (parser, tv_rparen))
     return error_mark_node;
 
+  /* A case with an erroneous argument is dropped, rather than
+     checked with the arguments left.  */
+  if (error_count != errors)
+    {
+      free_tree (t);
+      return error_mark_node;
+    }
+
+  /* Random arguments of one case are drawn together, so they
+     must produce the same number of values.  */
+  DL_FOREACH (TREE_LIST (t), el)
+    if (TREE_CODE (el->entry) == RANDOM)
+      {
+	if (count == NULL)
+	  count = TREE_VALUE (TREE_OPERAND (el->entry, 1));
+	else if (strcmp (count, TREE_VALUE (TREE_OPERAND (el->entry, 1))))
+	  {
+	    error_loc (TREE_LOCATION (el->entry), "random arguments of "
+		       "one case must have the same count");
+	    free_tree (t);
+	    return error_mark_node;
+	  }
+      }
+
   return t;
 error:
   parser_get_until_tval (parser, tv_rparen);
@@ -295,11 +827,367 @@ error:
 
 }
 
+static tree
+handle_combine_value (struct parser *parser)
+{
+  enum token_class cls;
+  return handle_literal (parser, &cls);
+}
+
+/* Parse the covering array
+     combine ( pairwise | INT ) { ID : ( NUM [, NUM]* ) [, ...] }
+   and append a case for every row of the array to CASES.  Rows
+   are generated here, so that every combination of values of
+   any T parameters appears in some case.  The keyword `combine'
+   has been read already.  */
+static void
+handle_combine (struct parser *parser, tree cases)
+{
+  struct tree_list_element *el, *ell;
+  struct token *tok;
+  tree names = make_tree_list (), params = make_tree_list (), t;
+  int strength, k = 0, i, *sizes, *rows;
+  size_t n, x;
+
+  tok = parser_get_token (parser);
+  if (token_class (tok) == tok_id
+      && strcmp (token_as_string (tok), "pairwise") == 0)
+    strength = 2;
+  else if (token_class (tok) == tok_intnum
+	   && (strength = atoi (token_as_string (tok))) > 0)
+    ;
+  else
+    {
+      error_loc (token_location (tok), "strength of combination "
+		 "expected, `%s' found", token_as_string (tok));
+      goto error;
+    }
+
+  if (!parser_forward_tval (parser, tv_lbrace))
+    goto error;
+
+  do
+    {
+      tok = parser_get_token (parser);
+      if (token_class (tok) != tok_id)
+	{
+	  error_loc (token_location (tok), "parameter name expected, "
+		     "`%s' found", token_as_string (tok));
+	  goto error;
+	}
+      DL_FOREACH (TREE_LIST (names), el)
+	if (strcmp (TREE_VALUE (el->entry), token_as_string (tok)) == 0)
+	  {
+	    error_loc (token_location (tok), "parameter `%s' is defined "
+		       "already", token_as_string (tok));
+	    goto error;
+	  }
+      tree_list_append (names, make_value_tok (tok));
+
+      if (!parser_forward_tval (parser, tv_colon)
+	  || !parser_forward_tval (parser, tv_lparen))
+	goto error;
+      tree_list_append (params, handle_list (parser, handle_combine_value,
+					     tv_comma));
+      if (!parser_forward_tval (parser, tv_rparen))
+	goto error;
+      k++;
+    }
+  while (token_is_operator (parser_get_token (parser), tv_comma));
+  parser_unget (parser);
+
+  if (!parser_forward_tval (parser, tv_rbrace))
+    goto error;
+
+  sizes = (int *) malloc (k * sizeof (int));
+  i = 0;
+  DL_FOREACH (TREE_LIST (params), el)
+    {
+      sizes[i] = 0;
+      DL_FOREACH (TREE_LIST (el->entry), ell)
+	sizes[i]++;
+      if (sizes[i++] == 0)
+	{
+	  free (sizes);
+	  goto cleanup;
+	}
+    }
+
+  rows = covering_array (strength, k, sizes, &n);
+  for (x = 0; x < n; x++)
+    {
+      tree args = make_tree_list ();
+
+      i = 0;
+      DL_FOREACH (TREE_LIST (params), el)
+	{
+	  int v = rows[x * k + i++];
+	  DL_FOREACH (TREE_LIST (el->entry), ell)
+	    if (v-- == 0)
+	      break;
+	  t = make_value_str (TREE_VALUE (ell->entry));
+	  TREE_LOCATION (t) = TREE_LOCATION (ell->entry);
+	  tree_list_append (args, t);
+	}
+      TREE_LOCATION (args) = TREE_LOCATION (TREE_LIST (args)->entry);
+      tree_list_append (cases, args);
+    }
+  printf ("note: %zu cases cover all %i-way combinations of %i "
+	  "parameters.\n", n, strength < k ? strength : k, k);
+  free (rows);
+  free (sizes);
+  goto cleanup;
+
+error:
+  parser_get_until_tval (parser, tv_rbrace);
+cleanup:
+  free_tree (names);
+  free_tree (params);
+}
+
+/* Parse the external source of cases
+     cases from ( STRING [ record STRING ] | generator ID )
+   The file is a CSV file, or a file of binary records described
+   by struct format if `record' is given.  A generator is a function
+   of the prototype which yields tuples of arguments.  Neither is
+   read by PIPO.  The keyword `cases' has been read already.  */
+static tree
+handle_file_cases (struct parser *parser, struct token *start)
+{
+  struct token *tok;
+  tree t = make_tree (FILE_CASES);
+
+  TREE_LOCATION (t) = token_location (start);
+  if (!parser_forward_tval (parser, tv_from))
+    goto error;
+
+  tok = parser_get_token (parser);
+  if (token_class (tok) == tok_id
+      && strcmp (token_as_string (tok), "generator") == 0)
+    {
+      free_tree (t);
+      t = make_tree (GENERATOR);
+      TREE_LOCATION (t) = token_location (start);
+      tok = parser_get_token (parser);
+      if (token_class (tok) != tok_id)
+	{
+	  error_loc (token_location (tok), "generator name expected, "
+		     "`%s' found", token_as_string (tok));
+	  goto error;
+	}
+      TREE_OPERAND_SET (t, 0, make_value_tok (tok));
+      return t;
+    }
+
+  if (token_class (tok) != tok_string)
+    {
+      error_loc (token_location (tok), "file name expected, `%s' found",
+		 token_as_string (tok));
+      goto error;
+    }
+  TREE_OPERAND_SET (t, 0, make_value_tok (tok));
+
+  tok = parser_get_token (parser);
+  if (token_class (tok) == tok_id
+      && strcmp (token_as_string (tok), "record") == 0)
+    {
+      tok = parser_get_token (parser);
+      if (token_class (tok) != tok_string)
+	{
+	  error_loc (token_location (tok), "record format expected, "
+		     "`%s' found", token_as_string (tok));
+	  goto error;
+	}
+      TREE_OPERAND_SET (t, 1, make_value_tok (tok));
+    }
+  else
+    parser_unget (parser);
+
+  return t;
+error:
+  free_tree (t);
+  return error_mark_node;
+}
+
+/* Read the value expected from the case ARGS after `='.  The
+   value is given only for the cases whose arguments are literals,
+   so that the case can be checked without the prototype.  If the
+   signature SIG is known, the value must be of the type of the
+   result.  */
+static tree
+handle_expect (struct parser *parser, struct token *start, tree args,
+	       tree sig)
+{
+  struct tree_list_element *el;
+  enum token_class cls;
+  tree t, value;
+
+  value = handle_literal (parser, &cls);
+  if (value == error_mark_node)
+    goto error;
+  if (cls != tok_intnum && cls != tok_octnum && cls != tok_hexnum
+      && cls != tok_realnum && cls != tok_string)
+    {
+      error_loc (TREE_LOCATION (value), "number or string expected after "
+		 "`=', `%s' found", TREE_VALUE (value));
+      free_tree (value);
+      goto error;
+    }
+  if (sig != NULL
+      && !type_value_p (type_lookup (TREE_VALUE (TREE_LIST (sig)->entry)),
+			TREE_VALUE (value)))
+    {
+      error_loc (TREE_LOCATION (value), "expected value `%s' is not of "
+		 "type `%s'", TREE_VALUE (value),
+		 TREE_VALUE (TREE_LIST (sig)->entry));
+      free_tree (value);
+      goto error;
+    }
+  if (args == error_mark_node)
+    {
+      free_tree (value);
+      return error_mark_node;
+    }
+
+  DL_FOREACH (TREE_LIST (args), el)
+    if (TREE_CODE (el->entry) != VALUE)
+      {
+	error_loc (TREE_LOCATION (el->entry), "expected value is given "
+		   "for a case with generated arguments");
+	free_tree (value);
+	goto error;
+      }
+
+  t = make_tree (EXPECT);
+  TREE_LOCATION (t) = token_location (start);
+  TREE_OPERAND_SET (t, 0, args);
+  TREE_OPERAND_SET (t, 1, value);
+  return t;
+error:
+  free_tree (args);
+  return error_mark_node;
+}
+
+/* Parse the cases of the function.  A case is either a tuple of
+   arguments, a covering array which produces several tuples, or
+   a file with the tuples.  SIG is the signature of the function or
+   NULL.  */
+static tree
+handle_case_list (struct parser *parser, tree sig)
+{
+  tree cases = make_tree_list ();
+  tree t;
+
+  do
+    {
+      struct token *tok = parser_get_token (parser);
+
+      if (token_is_keyword (tok, tv_combine))
+	handle_combine (parser, cases);
+      else if (token_is_keyword (tok, tv_cases))
+	{
+	  t = handle_file_cases (parser, tok);
+	  if (t != error_mark_node)
+	    tree_list_append (cases, t);
+	}
+      else
+	{
+	  parser_unget (parser);
+	  t = handle_args (parser);
+	  if (token_is_operator (tok = parser_get_token (parser), tv_assign))
+	    t = handle_expect (parser, tok, t, sig);
+	  else
+	    parser_unget (parser);
+	  if (t != NULL && t != error_mark_node)
+	    tree_list_append (cases, t);
+	}
+    }
+  while (token_is_operator (parser_get_token (parser), tv_comma));
+  parser_unget (parser);
+
+  return cases;
+}
+
+/* Read a name of a type.  */
+static tree
+handle_type (struct parser *parser)
+{
+  struct token *tok = parser_get_token (parser);
+
+  if (token_class (tok) != tok_id
+      || type_lookup (token_as_string (tok)) == TYPE_MAX)
+    {
+      error_loc (token_location (tok), "type expected, `%s' found",
+		 token_as_string (tok));
+      return error_mark_node;
+    }
+  return make_value_tok (tok);
+}
+
+/* Parse the signature of the function
+     : TYPE ( [ TYPE [, TYPE]* ] )
+   The result is a list of types, the first one is the type of the
+   returned value.  The colon has been read already.  */
+static tree
+handle_signature (struct parser *parser)
+{
+  struct tree_list_element *el;
+  tree sig = make_tree_list (), t;
+
+  if ((t = handle_type (parser)) == error_mark_node)
+    goto error;
+  tree_list_append (sig, t);
+
+  if (!parser_forward_tval (parser, tv_lparen))
+    goto error;
+  if (!token_is_operator (parser_get_token (parser), tv_rparen))
+    {
+      parser_unget (parser);
+      t = handle_list (parser, handle_type, tv_comma);
+      DL_CONCAT (TREE_LIST (sig), TREE_LIST (t));
+      TREE_LIST (t) = NULL;
+      free_tree (t);
+      if (!parser_forward_tval (parser, tv_rparen))
+	goto error;
+    }
+
+  DL_FOREACH (TREE_LIST (sig)->next, el)
+    if (type_lookup (TREE_VALUE (el->entry)) == TYPE_VOID)
+      {
+	error_loc (TREE_LOCATION (el->entry), "argument of type `void'");
+	goto error;
+      }
+  return sig;
+error:
+  free_tree (sig);
+  return error_mark_node;
+}
+
+/* Names of the attributes a function may have.  `vectorized'
+   means that the prototype accepts lists of values of every argument
+   and returns the list of results.  */
+static const char *function_attributes[] = { "vectorized", NULL };
+
+/* Number of arguments of the C function passed by the case ARGS.
+   A blob is passed as two arguments.  */
+static int
+case_arity (tree args)
+{
+  struct tree_list_element *el;
+  int n = 0;
+
+  DL_FOREACH (TREE_LIST (args), el)
+    n += TREE_CODE (el->entry) == BLOB ? 2 : 1;
+  return n;
+}
+
 tree
 handle_cases (struct parser *parser)
 {
+  struct tree_list_element *el, *al;
   struct token *tok;
   tree function, t;
+  int arity, i;
 
   if (!parser_forward_tval (parser, tv_function))
     goto error;
@@ -307,13 +1195,73 @@ handle_cases (struct parser *parser)
   function = make_tree (FUNCTION);
   TREE_OPERAND_SET (function, 0, make_value_tok (tok));
 
+  if (token_is_operator (parser_get_token (parser), tv_colon))
+    {
+      t = handle_signature (parser);
+      if (t == error_mark_node)
+	goto error;
+      TREE_OPERAND_SET (function, 2, t);
+    }
+  else
+    parser_unget (parser);
+
+  /* Attributes of the function.  */
+  while (token_class (tok = parser_get_token (parser)) == tok_id)
+    {
+      for (i = 0; function_attributes[i] != NULL; i++)
+	if (strcmp (token_as_string (tok), function_attributes[i]) == 0)
+	  break;
+      if (function_attributes[i] == NULL)
+	error_loc (token_location (tok), "unknown attribute `%s'",
+		   token_as_string (tok));
+      else
+	{
+	  if (TREE_OPERAND (function, 3) == NULL)
+	    TREE_OPERAND_SET (function, 3, make_tree_list ());
+	  tree_list_append (TREE_OPERAND (function, 3), make_value_tok (tok));
+	}
+    }
+  parser_unget (parser);
+
   if (!parser_forward_tval (parser, tv_lbrace))
     goto error;
 
-  t = handle_list (parser, handle_args, tv_comma);
+  t = handle_case_list (parser, TREE_OPERAND (function, 2));
 
   TREE_OPERAND_SET (function, 1, t);
 
+  /* Check the number of arguments against the signature.  */
+  if (TREE_OPERAND (function, 2) != NULL)
+    {
+      arity = -1;
+      DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 2)), el)
+	arity++;
+      DL_FOREACH (TREE_LIST (t), el)
+	{
+	  tree args = el->entry;
+
+	  if (TREE_CODE (args) == EXPECT)
+	    args = TREE_OPERAND (args, 0);
+	  if (TREE_CODE (args) == LIST && case_arity (args) != arity)
+	    error_loc (TREE_LOCATION (args),
+		       "function `%s' takes %i arguments, %i given",
+		       TREE_VALUE (TREE_OPERAND (function, 0)), arity,
+		       case_arity (args));
+	}
+    }
+
+  /* Every call of a vectorized function must be independent from
+     the others, so the arguments passed by pointer are rejected.  */
+  if (function_attribute_p (function, "vectorized"))
+    DL_FOREACH (TREE_LIST (t), el)
+      if (TREE_CODE (el->entry) == LIST)
+	DL_FOREACH (TREE_LIST (el->entry), al)
+	  if (TREE_CODE (al->entry) == BLOB || TREE_CODE (al->entry) == ARRAY
+	      || TREE_CODE (al->entry) == OUTBUF)
+	    error_loc (TREE_LOCATION (al->entry), "buffer argument of "
+		       "vectorized function `%s'",
+		       TREE_VALUE (TREE_OPERAND (function, 0)));
+
   if (!parser_forward_tval (parser, tv_rbrace))
     return error_mark_node;
 
@@ -323,6 +1271,40 @@ error:
   return error_mark_node;
 }
 
+/* Add FUNCTION to the list of functions of MODULE.  Cases of
+   functions with the same name are merged, as merged scenarios
+   often test one function in several places.  */
+static void
+add_function (tree module, tree function)
+{
+  struct tree_list_element *el;
+  tree name = TREE_OPERAND (function, 0);
+
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (module, 1)), el)
+    if (el->entry != error_mark_node
+	&& strcmp (TREE_VALUE (TREE_OPERAND (el->entry, 0)),
+		   TREE_VALUE (name)) == 0)
+      {
+	if (TREE_OPERAND (function, 2) != NULL
+	    && TREE_OPERAND (el->entry, 2) != NULL)
+	  {
+	    /* Check the signatures before FUNCTION is freed.  */
+	    char *k1 = case_key (TREE_OPERAND (function, 2));
+	    char *k2 = case_key (TREE_OPERAND (el->entry, 2));
+
+	    if (strcmp (k1, k2) != 0)
+	      error_loc (TREE_LOCATION (name), "conflicting signatures "
+			 "of function `%s'", TREE_VALUE (name));
+	    free (k1);
+	    free (k2);
+	  }
+	merge_function (el->entry, function);
+	return;
+      }
+
+  tree_list_append (TREE_OPERAND (module, 1), function);
+}
+
 tree
 handle_module (struct parser *parser)
 {
@@ -343,7 +1325,10 @@ handle_module (struct parser *parser)
     {
       parser_unget (parser);
       t = handle_cases (parser);
-      tree_list_append (TREE_OPERAND (module, 1), t);
+      if (t == error_mark_node)
+	tree_list_append (TREE_OPERAND (module, 1), t);
+      else
+	add_function (module, t);
     }
   parser_unget (parser);
 
@@ -360,7 +1345,11 @@ error:
 int
 parse (struct parser *parser)
 {
+  struct tree_list_element *el, *tmp, *fl;
   struct token *tok;
+  tree m;
+  int removed, total = 0;
+
   error_count = warning_count = 0;
   while (token_class (tok = parser_get_token (parser)) != tok_eof)
     {
@@ -371,14 +1360,22 @@ parse (struct parser *parser)
       tree t = handle_module (parser);
       if (t != NULL && t != error_mark_node)
 	{
-	  if (!module_exists (module_list,
-	    TREE_VALUE (TREE_OPERAND (t, 0))))
+	  if (!(m = module_exists (module_list,
+	    TREE_VALUE (TREE_OPERAND (t, 0)))))
 	    tree_list_append (module_list, t);
 	  else
 	    {
-	      error_loc (TREE_LOCATION (t),
-		    "function `%s' is defined already",
-		    TREE_VALUE (TREE_OPERAND (t, 0)));
+	      /* Blocks of one module are merged.  */
+	      DL_FOREACH_SAFE (TREE_LIST (TREE_OPERAND (t, 1)), el, tmp)
+		{
+		  DL_DELETE (TREE_LIST (TREE_OPERAND (t, 1)), el);
+		  if (el->entry == error_mark_node)
+		    tree_list_append (TREE_OPERAND (m, 1), el->entry);
+		  else
+		    add_function (m, el->entry);
+		  free (el);
+		}
+	      free_tree (t);
 	    }
 	}
       parser->lex->error_notifications = false;
@@ -391,5 +1388,18 @@ parse (struct parser *parser)
       return -3;
     }
 
+  /* Remove repeated cases.  */
+  DL_FOREACH (TREE_LIST (module_list), el)
+    DL_FOREACH (TREE_LIST (TREE_OPERAND (el->entry, 1)), fl)
+      if ((removed = dedup_cases (TREE_OPERAND (fl->entry, 1))) != 0)
+	{
+	  printf ("note: %i duplicate cases of `%s.%s' removed.\n", removed,
+		  TREE_VALUE (TREE_OPERAND (el->entry, 0)),
+		  TREE_VALUE (TREE_OPERAND (fl->entry, 0)));
+	  total += removed;
+	}
+  if (total != 0)
+    printf ("note: %i duplicate cases removed in total.\n", total);
+
   return 0;
 }
@@ -58,6 +58,14 @@ token_is_number (struct token *tok)
 	  || token_class (tok) == tok_hexnum);
 }
 
+static inline bool
+token_is_integer (struct token *tok)
+{
+  return (token_class (tok) == tok_intnum
+	  || token_class (tok) == tok_octnum
+	  || token_class (tok) == tok_hexnum);
+}
+
 int parse (struct parser *);
 bool parser_init (struct parser *, struct lexer *);
 bool parser_finalize (struct parser *);
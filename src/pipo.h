@@ -139,6 +139,9 @@ struct lexer
   struct location loc;
   struct token curtoken;
   bool is_eof;
+  /* Set when a number was terminated by `..', so the range
+     operator is returned by the next call to the lexer.  */
+  bool dotdot_pending;
   /* Mark and print possible errors in case of true.
      NOTE When lexer is beyond function, we can skip all errors.  */
   bool error_notifications;
@@ -0,0 +1,1683 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+/* Execution of the cases with expected values inside PIPO.  The
+   libraries are loaded by dlopen, and the functions are called by a
+   small call engine driven by the signatures: arguments of integer
+   types and strings are passed as 64-bit integers, arguments of real
+   types as doubles.  On x86-64 and AArch64 all of them go in
+   registers, integers and reals independently, so a function of up
+   to RUN_INT_ARGS integers and RUN_REAL_ARGS reals is called through
+   a pointer taking all of them.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "pipo.h"
+#include "tree.h"
+#include "global.h"
+#include "types.h"
+#include "dedup.h"
+#include "bake.h"
+#include "run.h"
+
+#define RUN_INT_ARGS 6
+#define RUN_REAL_ARGS 8
+
+/* Largest number of cases in a chunk, which is also the number of
+   cases checked by one child in isolated mode, and the number of
+   chunks a function is split into per worker.  */
+#define RUN_BATCH 256
+#define RUN_CHUNKS_PER_WORKER 4
+
+/* Set if every batch of cases is checked in a child process.  The
+   limits of a case are the time in milliseconds, both wall and CPU,
+   and the address space in megabytes, or 0 for no limit.  */
+static bool isolate = false;
+static long run_timeout = 1000;
+static long run_memory = 0;
+
+/* Number of workers, and whether the run stops after the first
+   failure.  RUN_STOP is set when it does.  */
+static int run_jobs = 1;
+static bool fail_fast = false;
+static int run_stop = 0;
+
+/* Addresses of the coordinator in distributed mode.  The cases are
+   split for RUN_REMOTE_WORKERS workers, and a chunk whose worker died
+   or did not check it in LEASE_TIME seconds is given to another one at
+   most RUN_LEASES times.  */
+static const char *serve_addr = NULL;
+static const char *connect_addr = NULL;
+static long lease_time = 600;
+#define RUN_REMOTE_WORKERS 16
+#define RUN_LEASES 3
+
+/* Workers computing the expected values by the prototypes while the
+   cases are run, or -1 if they are not baked.  A stage of a pipelined
+   run is at most RUN_QUEUE chunks ahead of the next one.  */
+static int bake_jobs = -1;
+#define RUN_QUEUE 4
+
+/* Value of an argument or of a result.  */
+union run_value
+{
+  int64_t i;
+  uint64_t u;
+  double d;
+  float f;
+  const char *s;
+};
+
+typedef int64_t (*run_int_fn) (int64_t, int64_t, int64_t, int64_t, int64_t,
+			       int64_t, double, double, double, double,
+			       double, double, double, double);
+typedef double (*run_real_fn) (int64_t, int64_t, int64_t, int64_t, int64_t,
+			       int64_t, double, double, double, double,
+			       double, double, double, double);
+
+/* Address returned by dlsym, seen as a function of either kind.  */
+union run_fn
+{
+  void *p;
+  run_int_fn i;
+  run_real_fn d;
+};
+
+/* A function under test and its cases with expected values.  BASE is
+   the index of the first of them among all the cases of the function
+   with expected values.  */
+struct run_function
+{
+  tree module, function;
+  union run_fn fn;
+  tree *cases;
+  int n, base;
+};
+
+/* Cases from LO to HI of a function checked by one worker, the
+   number of checked and failed ones and the reports of failures.  In
+   a pipelined run, RESULTS are those of the calls not checked yet.  */
+struct run_chunk
+{
+  struct run_function *function;
+  int lo, hi, done, failed;
+  char *out;
+  size_t size;
+  union run_value *results;
+};
+
+/* Chunks from TOP to BOTTOM not taken yet by the workers.  */
+struct run_deque
+{
+  pthread_mutex_t lock;
+  size_t top, bottom;
+};
+
+/* Chunks of the cases, and the libraries they call.  FAILED counts
+   the libraries and functions which are not found.  */
+struct run_pool
+{
+  struct run_chunk *chunks;
+  size_t nchunks, size;
+  struct run_deque *deques;
+  int workers, failed, skipped;
+  void **libs;
+  size_t nlibs;
+};
+
+/* Check if FUNCTION can be called by the engine: its signature is
+   known, its arguments and result are numbers or strings, and its
+   arguments fit in the registers.  */
+static bool
+run_function_p (tree function)
+{
+  struct tree_list_element *el;
+  enum type_code code;
+  int ints = 0, reals = 0;
+
+#if !defined (__x86_64__) && !defined (__aarch64__)
+  return false;
+#endif
+  if (TREE_OPERAND (function, 2) == NULL)
+    return false;
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (function, 2)), el)
+    {
+      code = type_lookup (TREE_VALUE (el->entry));
+      if (!TYPE_IS_NUMBER (code) && code != TYPE_STR)
+	return false;
+      if (el == TREE_LIST (TREE_OPERAND (function, 2)))
+	continue;
+      if (TYPE_CLASS (code) == type_real)
+	reals++;
+      else
+	ints++;
+    }
+  return ints <= RUN_INT_ARGS && reals <= RUN_REAL_ARGS;
+}
+
+/* Decode the string literal VAL with the quotes into a new string.  */
+static char *
+run_string (const char *val)
+{
+  char *s = malloc (strlen (val)), *p = s, *end;
+
+  if (s == NULL)
+    err (EXIT_FAILURE, "malloc failed");
+  for (val++; *val != '"' && *val != '\0'; val++)
+    {
+      if (*val != '\\')
+	{
+	  *p++ = *val;
+	  continue;
+	}
+      switch (*++val)
+	{
+	case 'n': *p++ = '\n'; break;
+	case 't': *p++ = '\t'; break;
+	case 'r': *p++ = '\r'; break;
+	case 'x':
+	  *p++ = (char) strtoul (val + 1, &end, 16);
+	  val = end - 1;
+	  break;
+	default:
+	  if (*val >= '0' && *val <= '7')
+	    {
+	      *p++ = (char) strtoul (val, &end, 8);
+	      val = end - 1;
+	    }
+	  else
+	    *p++ = *val;
+	}
+    }
+  *p = '\0';
+  return s;
+}
+
+/* Convert the literal T, which is of type CODE, to the value V.
+   Strings are allocated and must be freed by the caller.  */
+static void
+run_literal (tree t, enum type_code code, union run_value *v)
+{
+  const char *val = TREE_VALUE (t);
+
+  memset (v, 0, sizeof (*v));
+  switch (TYPE_CLASS (code))
+    {
+    case type_signed:
+      v->i = strtoll (val, NULL, 0);
+      break;
+    case type_unsigned:
+      v->u = strtoull (val, NULL, 0);
+      break;
+    case type_real:
+      if (code == TYPE_F32)
+	v->f = strtof (val, NULL);
+      else
+	v->d = strtod (val, NULL);
+      break;
+    default:
+      v->s = val[0] == '"' ? run_string (val) : NULL;
+      break;
+    }
+}
+
+/* Truncate the integer returned in a register to the type CODE.  */
+static void
+run_result (union run_value *v, enum type_code code)
+{
+  switch (code)
+    {
+    case TYPE_I8: v->i = (int8_t) v->i; break;
+    case TYPE_I16: v->i = (int16_t) v->i; break;
+    case TYPE_I32: v->i = (int32_t) v->i; break;
+    case TYPE_U8: v->u = (uint8_t) v->u; break;
+    case TYPE_U16: v->u = (uint16_t) v->u; break;
+    case TYPE_U32: v->u = (uint32_t) v->u; break;
+    default: break;
+    }
+}
+
+/* Call FN with the signature SIG and the arguments ARGS.  */
+static union run_value
+run_call (union run_fn fn, tree sig, union run_value *args)
+{
+  struct tree_list_element *el;
+  enum type_code ret = type_lookup (TREE_VALUE (TREE_LIST (sig)->entry));
+  enum type_code code;
+  int64_t x[RUN_INT_ARGS] = { 0 };
+  double d[RUN_REAL_ARGS] = { 0 };
+  union run_value r;
+  int ints = 0, reals = 0, i = 0;
+
+  /* A float is passed in the low bits of a vector register.  */
+  for (el = TREE_LIST (sig)->next; el != NULL; el = el->next, i++)
+    {
+      code = type_lookup (TREE_VALUE (el->entry));
+      if (TYPE_CLASS (code) == type_real)
+	memcpy (&d[reals++], &args[i], sizeof (double));
+      else
+	x[ints++] = args[i].i;
+    }
+
+  memset (&r, 0, sizeof (r));
+  if (TYPE_CLASS (ret) == type_real)
+    r.d = fn.d (x[0], x[1], x[2], x[3], x[4], x[5],
+		  d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]);
+  else
+    {
+      r.i = fn.i (x[0], x[1], x[2], x[3], x[4], x[5],
+		   d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]);
+      run_result (&r, ret);
+    }
+  return r;
+}
+
+/* Check if the result R of type CODE equals the expected value E.
+   Reals are equal if both are NaN.  */
+static bool
+run_equal_p (union run_value r, union run_value e, enum type_code code)
+{
+  switch (TYPE_CLASS (code))
+    {
+    case type_real:
+      if (code == TYPE_F32)
+	return r.f == e.f || (r.f != r.f && e.f != e.f);
+      return r.d == e.d || (r.d != r.d && e.d != e.d);
+    case type_pointer:
+      return r.s == e.s || (r.s != NULL && e.s != NULL
+			    && strcmp (r.s, e.s) == 0);
+    default:
+      return r.u == e.u;
+    }
+}
+
+/* Print the value V of type CODE.  */
+static void
+run_print (FILE *f, union run_value v, enum type_code code)
+{
+  switch (TYPE_CLASS (code))
+    {
+    case type_signed:
+      fprintf (f, "%lld", (long long) v.i);
+      break;
+    case type_unsigned:
+      fprintf (f, "%llu", (unsigned long long) v.u);
+      break;
+    case type_real:
+      fprintf (f, "%.17g", code == TYPE_F32 ? (double) v.f : v.d);
+      break;
+    default:
+      fprintf (f, v.s != NULL ? "\"%s\"" : "NULL", v.s);
+      break;
+    }
+}
+
+/* Flags of dlopen from PIPO_RTLD environment variable, as in the
+   generated python test.  */
+static int
+run_rtld (void)
+{
+  const char *env = getenv ("PIPO_RTLD");
+  char *flags, *flag, *save = NULL;
+  int mode = 0;
+
+  if (env == NULL)
+    return RTLD_NOW;
+  if ((flags = strdup (env)) == NULL)
+    err (EXIT_FAILURE, "strdup failed");
+  for (flag = strtok_r (flags, ", ", &save); flag != NULL;
+       flag = strtok_r (NULL, ", ", &save))
+    if (strcasecmp (flag, "lazy") == 0)
+      mode |= RTLD_LAZY;
+    else if (strcasecmp (flag, "now") == 0)
+      mode |= RTLD_NOW;
+    else if (strcasecmp (flag, "global") == 0)
+      mode |= RTLD_GLOBAL;
+    else if (strcasecmp (flag, "local") == 0)
+      mode |= RTLD_LOCAL;
+    else
+      warnx ("unknown flag of dlopen `%s'", flag);
+  free (flags);
+  return (mode & (RTLD_LAZY | RTLD_NOW)) ? mode : mode | RTLD_NOW;
+}
+
+/* Print the case I of FUNCTION of MODULE as written in the scenario
+   to F.  */
+static void
+run_print_case (FILE *f, tree module, tree function, tree t, int i)
+{
+  struct tree_list_element *el;
+
+  fprintf (f, "%s.%s: case %i (", TREE_VALUE (TREE_OPERAND (module, 0)),
+	   TREE_VALUE (TREE_OPERAND (function, 0)), i);
+  DL_FOREACH (TREE_LIST (TREE_OPERAND (t, 0)), el)
+    fprintf (f, "%s%s", TREE_VALUE (el->entry), el->next != NULL ? ", " : "");
+  fprintf (f, ")");
+}
+
+/* Check if the literals of the case I of the function FI are of the
+   types of its signature, as the values they are converted to would
+   be saturated or wrapped otherwise.  An invalid case is reported to
+   OUT unless it is NULL.  */
+static bool
+run_valid_p (struct run_function *fi, int i, FILE *out)
+{
+  struct tree_list_element *al, *sl;
+  tree t = fi->cases[i], sig = TREE_OPERAND (fi->function, 2);
+  tree bad = NULL, type = TREE_LIST (sig)->entry;
+
+  if (!type_value_p (type_lookup (TREE_VALUE (type)),
+		     TREE_VALUE (TREE_OPERAND (t, 1))))
+    bad = TREE_OPERAND (t, 1);
+  for (sl = TREE_LIST (sig)->next, al = TREE_LIST (TREE_OPERAND (t, 0));
+       bad == NULL && sl != NULL && al != NULL; sl = sl->next, al = al->next)
+    if (!type_value_p (type_lookup (TREE_VALUE (sl->entry)),
+		       TREE_VALUE (al->entry)))
+      {
+	bad = al->entry;
+	type = sl->entry;
+      }
+  if (bad != NULL && out != NULL)
+    {
+      run_print_case (out, fi->module, fi->function, t, fi->base + i);
+      fprintf (out, ": invalid, `%s' is not of type `%s'\n",
+	       TREE_VALUE (bad), TREE_VALUE (type));
+    }
+  return bad == NULL;
+}
+
+/* Call the function FI with the arguments of the case I.  A string
+   returned is copied, as it may be one of the arguments or be
+   overwritten by the next call, and must be freed by the caller.  */
+static union run_value
+run_native (struct run_function *fi, int i)
+{
+  struct tree_list_element *al, *sl;
+  tree t = fi->cases[i], sig = TREE_OPERAND (fi->function, 2);
+  enum type_code ret = type_lookup (TREE_VALUE (TREE_LIST (sig)->entry));
+  union run_value args[RUN_INT_ARGS + RUN_REAL_ARGS], r;
+  int nargs = 0, j;
+
+  for (sl = TREE_LIST (sig)->next, al = TREE_LIST (TREE_OPERAND (t, 0));
+       sl != NULL && al != NULL; sl = sl->next, al = al->next)
+    run_literal (al->entry, type_lookup (TREE_VALUE (sl->entry)),
+		 &args[nargs++]);
+  r = run_call (fi->fn, sig, args);
+  if (ret == TYPE_STR && r.s != NULL && (r.s = strdup (r.s)) == NULL)
+    err (EXIT_FAILURE, "strdup failed");
+
+  for (sl = TREE_LIST (sig)->next, j = 0; j < nargs; sl = sl->next, j++)
+    if (type_lookup (TREE_VALUE (sl->entry)) == TYPE_STR)
+      free ((char *) args[j].s);
+  return r;
+}
+
+/* Check the result R of the case I of the function FI.  Returns true
+   if it is the expected value, otherwise the failure is reported to
+   OUT.  */
+static bool
+run_check (struct run_function *fi, int i, union run_value r, FILE *out)
+{
+  tree t = fi->cases[i], sig = TREE_OPERAND (fi->function, 2);
+  enum type_code ret = type_lookup (TREE_VALUE (TREE_LIST (sig)->entry));
+  union run_value e;
+  bool ok;
+
+  run_literal (TREE_OPERAND (t, 1), ret, &e);
+  if (!(ok = run_equal_p (r, e, ret)))
+    {
+      run_print_case (out, fi->module, fi->function, t, fi->base + i);
+      fprintf (out, ": ");
+      run_print (out, r, ret);
+      fprintf (out, " != ");
+      run_print (out, e, ret);
+      fprintf (out, "\n");
+    }
+
+  if (ret == TYPE_STR)
+    free ((char *) e.s);
+  return ok;
+}
+
+/* Check the case I of the function FI by calling it.  An invalid
+   case fails without the call.  */
+static bool
+run_case (struct run_function *fi, int i, FILE *out)
+{
+  union run_value r;
+  bool ok;
+
+  if (!run_valid_p (fi, i, out))
+    return false;
+  r = run_native (fi, i);
+  ok = run_check (fi, i, r, out);
+
+  if (type_lookup (TREE_VALUE (TREE_LIST (TREE_OPERAND (fi->function, 2))
+			       ->entry)) == TYPE_STR)
+    free ((char *) r.s);
+  return ok;
+}
+
+/* Read N bytes from FD to BUF, waiting at most the timeout of a case
+   for every part.  Returns 1 on success, 0 at the end of the file or
+   on error and -1 on timeout.  */
+static int
+run_read (int fd, void *buf, size_t n)
+{
+  struct pollfd pfd;
+  ssize_t done;
+  int ready;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while (n > 0)
+    {
+      if ((ready = poll (&pfd, 1, run_timeout)) == -1 && errno == EINTR)
+	continue;
+      if (ready == 0)
+	return -1;
+      if ((done = read (fd, buf, n)) <= 0)
+	return 0;
+      buf = (char *) buf + done;
+      n -= done;
+    }
+  return 1;
+}
+
+/* Check the cases from LO to HI of the function FI in a child process
+   forked from PIPO, which has the library loaded already.  The child
+   sends the status of every case and the report of a failure through
+   a pipe; a case which crashes the child, runs longer than the timeout
+   or takes more CPU time is reported to OUT as well.  The number of
+   failed cases is added to FAILED.  Returns the index of the first
+   case not checked.  */
+static int
+run_batch (struct run_function *fi, int lo, int hi, int *failed, FILE *out)
+{
+  int p[2], i = lo, status = 0, got = 0;
+  uint32_t len;
+  char c, *msg;
+  pid_t pid;
+
+  fflush (stdout);
+  if (pipe (p) == -1)
+    err (EXIT_FAILURE, "pipe failed");
+  if ((pid = fork ()) == -1)
+    err (EXIT_FAILURE, "fork failed");
+
+  if (pid == 0)
+    {
+      struct itimerval it;
+      struct rlimit rl;
+      size_t size;
+      FILE *f;
+
+      close (p[0]);
+      if (run_memory > 0)
+	{
+	  rl.rlim_cur = rl.rlim_max = (rlim_t) run_memory << 20;
+	  setrlimit (RLIMIT_AS, &rl);
+	}
+      /* SIGPROF kills the child when a case takes more CPU time than
+	 allowed.  */
+      memset (&it, 0, sizeof (it));
+      it.it_value.tv_sec = run_timeout / 1000;
+      it.it_value.tv_usec = run_timeout % 1000 * 1000;
+      for (; i < hi; i++)
+	{
+	  msg = NULL;
+	  size = 0;
+	  if ((f = open_memstream (&msg, &size)) == NULL)
+	    _exit (EXIT_FAILURE);
+	  setitimer (ITIMER_PROF, &it, NULL);
+	  c = run_case (fi, i, f) ? 'P' : 'F';
+	  fclose (f);
+	  len = size;
+	  if (write (p[1], &c, 1) != 1
+	      || write (p[1], &len, sizeof (len)) != sizeof (len)
+	      || write (p[1], msg, len) != (ssize_t) len)
+	    _exit (EXIT_FAILURE);
+	  free (msg);
+	}
+      _exit (EXIT_SUCCESS);
+    }
+
+  close (p[1]);
+  while (i < hi)
+    {
+      if ((got = run_read (p[0], &c, 1)) != 1
+	  || (got = run_read (p[0], &len, sizeof (len))) != 1)
+	break;
+      if ((msg = malloc (len + 1)) == NULL)
+	err (EXIT_FAILURE, "malloc failed");
+      got = run_read (p[0], msg, len);
+      if (got == 1)
+	fwrite (msg, 1, len, out);
+      free (msg);
+      if (got != 1)
+	break;
+      *failed += c == 'F';
+      i++;
+    }
+  if (got == -1)
+    kill (pid, SIGKILL);
+  close (p[0]);
+  while (waitpid (pid, &status, 0) == -1 && errno == EINTR)
+    ;
+  if (i == hi)
+    return hi;
+
+  (*failed)++;
+  run_print_case (out, fi->module, fi->function, fi->cases[i],
+		  fi->base + i);
+  if (got == -1)
+    fprintf (out, ": timed out after %li ms\n", run_timeout);
+  else if (WIFSIGNALED (status) && WTERMSIG (status) == SIGPROF)
+    fprintf (out, ": more than %li ms of CPU time\n", run_timeout);
+  else if (WIFSIGNALED (status))
+    fprintf (out, ": killed by signal %i (%s)\n", WTERMSIG (status),
+	     strsignal (WTERMSIG (status)));
+  else
+    fprintf (out, ": exited with status %i\n", WEXITSTATUS (status));
+  return i + 1;
+}
+
+/* Check the cases of the chunk C, unless the run is stopped.  */
+static void
+run_chunk (struct run_chunk *c)
+{
+  FILE *out;
+  int i;
+
+  if ((out = open_memstream (&c->out, &c->size)) == NULL)
+    err (EXIT_FAILURE, "open_memstream failed");
+  i = c->lo;
+  while (i < c->hi && !__atomic_load_n (&run_stop, __ATOMIC_RELAXED))
+    if (isolate)
+      i = run_batch (c->function, i, c->hi, &c->failed, out);
+    else
+      c->failed += !run_case (c->function, i++, out);
+  c->done = i - c->lo;
+  fclose (out);
+  if (c->failed != 0 && fail_fast)
+    __atomic_store_n (&run_stop, 1, __ATOMIC_RELAXED);
+}
+
+/* Take a chunk from the bottom of the deque of the worker W, or steal
+   one from the top of the deque of another worker.  Returns NULL if
+   no chunks are left.  */
+static struct run_chunk *
+run_take (struct run_pool *pool, int w)
+{
+  struct run_deque *d;
+  struct run_chunk *c = NULL;
+  int k;
+
+  for (k = 0; k < pool->workers && c == NULL; k++)
+    {
+      d = &pool->deques[(w + k) % pool->workers];
+      pthread_mutex_lock (&d->lock);
+      if (d->top < d->bottom)
+	c = k == 0 ? &pool->chunks[--d->bottom] : &pool->chunks[d->top++];
+      pthread_mutex_unlock (&d->lock);
+    }
+  return c;
+}
+
+struct run_worker
+{
+  struct run_pool *pool;
+  int w;
+};
+
+static void *
+run_worker (void *arg)
+{
+  struct run_worker *rw = arg;
+  struct run_chunk *c;
+
+  while (!__atomic_load_n (&run_stop, __ATOMIC_RELAXED)
+	 && (c = run_take (rw->pool, rw->w)) != NULL)
+    run_chunk (c);
+  return NULL;
+}
+
+/* Check the chunks of POOL by its workers.  The chunks are dealt to
+   the workers in contiguous parts; a worker takes the chunks of its
+   part from the end and, when it runs out of them, steals from the
+   beginning of the parts of the others.  */
+static void
+run_pool (struct run_pool *pool)
+{
+  struct run_worker *rw;
+  pthread_t *threads;
+  int w;
+
+  if ((pool->deques = calloc (pool->workers, sizeof (struct run_deque)))
+      == NULL
+      || (rw = calloc (pool->workers, sizeof (struct run_worker))) == NULL
+      || (threads = calloc (pool->workers, sizeof (pthread_t))) == NULL)
+    err (EXIT_FAILURE, "calloc failed");
+  for (w = 0; w < pool->workers; w++)
+    {
+      pthread_mutex_init (&pool->deques[w].lock, NULL);
+      pool->deques[w].top = pool->nchunks * w / pool->workers;
+      pool->deques[w].bottom = pool->nchunks * (w + 1) / pool->workers;
+      rw[w].pool = pool;
+      rw[w].w = w;
+    }
+
+  /* The calling thread is the first worker.  */
+  for (w = 1; w < pool->workers; w++)
+    if (pthread_create (&threads[w], NULL, run_worker, &rw[w]) != 0)
+      err (EXIT_FAILURE, "pthread_create failed");
+  run_worker (&rw[0]);
+  for (w = 1; w < pool->workers; w++)
+    pthread_join (threads[w], NULL);
+
+  for (w = 0; w < pool->workers; w++)
+    pthread_mutex_destroy (&pool->deques[w].lock);
+  free (threads);
+  free (rw);
+  free (pool->deques);
+}
+
+/* Append a chunk of the cases from LO to HI of the function FI to
+   POOL.  */
+static struct run_chunk *
+run_append (struct run_pool *pool, struct run_function *fi, int lo, int hi)
+{
+  struct run_chunk *c;
+
+  if (pool->nchunks == pool->size)
+    {
+      pool->size = pool->size == 0 ? 64 : pool->size * 2;
+      pool->chunks = realloc (pool->chunks,
+			      pool->size * sizeof (struct run_chunk));
+      if (pool->chunks == NULL)
+	err (EXIT_FAILURE, "realloc failed");
+    }
+  c = &pool->chunks[pool->nchunks++];
+  memset (c, 0, sizeof (struct run_chunk));
+  c->function = fi;
+  c->lo = lo;
+  c->hi = hi;
+  return c;
+}
+
+/* Collect the cases with expected values of FUNCTION of MODULE from
+   the element FIRST to LAST, not included, which are checked by
+   calling FN.  */
+static struct run_function *
+run_new_function (void *fn, tree module, tree function,
+		  struct tree_list_element *first,
+		  struct tree_list_element *last)
+{
+  struct tree_list_element *el;
+  struct run_function *fi;
+  int n = 0;
+
+  if ((fi = calloc (1, sizeof (struct run_function))) == NULL)
+    err (EXIT_FAILURE, "calloc failed");
+  fi->module = module;
+  fi->function = function;
+  fi->fn.p = fn;
+  for (el = first; el != last; el = el->next)
+    n += TREE_CODE (el->entry) == EXPECT;
+  if ((fi->cases = malloc ((n + 1) * sizeof (tree))) == NULL)
+    err (EXIT_FAILURE, "malloc failed");
+  for (el = first; el != last; el = el->next)
+    if (TREE_CODE (el->entry) == EXPECT)
+      fi->cases[fi->n++] = el->entry;
+  return fi;
+}
+
+/* Add the cases with expected values of FUNCTION of MODULE to POOL,
+   split into chunks for SPLIT workers.  The function is looked up in
+   the library LIB, unless it is NULL.  Returns non-zero if the
+   function is not found.  */
+static int
+run_add_function (struct run_pool *pool, void *lib, tree module,
+		  tree function, int split)
+{
+  struct run_function *fi;
+  int i, size;
+  void *fn = NULL;
+
+  if (lib != NULL
+      && (fn = dlsym (lib, TREE_VALUE (TREE_OPERAND (function, 0)))) == NULL)
+    {
+      fprintf (stderr, "error: %s\n", dlerror ());
+      return 1;
+    }
+  fi = run_new_function (fn, module, function,
+			 TREE_LIST (TREE_OPERAND (function, 1)), NULL);
+
+  /* Several chunks per worker, so that the work can be balanced.  */
+  size = fi->n / (split * RUN_CHUNKS_PER_WORKER);
+  size = size < 1 ? 1 : size > RUN_BATCH ? RUN_BATCH : size;
+  for (i = 0; i < fi->n || i == 0; i += size)
+    run_append (pool, fi, i, i + size < fi->n ? i + size : fi->n);
+  return 0;
+}
+
+/* Load the libraries `./lib<module>.so' of all the modules into
+   POOL.  A library which cannot be loaded is NULL.  */
+static void
+run_load (struct run_pool *pool)
+{
+  struct tree_list_element *tl;
+  char *path = NULL;
+
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    pool->nlibs++;
+  if ((pool->libs = calloc (pool->nlibs + 1, sizeof (void *))) == NULL)
+    err (EXIT_FAILURE, "calloc failed");
+
+  pool->nlibs = 0;
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    {
+      if (-1 == asprintf (&path, "./lib%s.so",
+			  TREE_VALUE (TREE_OPERAND (tl->entry, 0))))
+	err (EXIT_FAILURE, "asprintf failed");
+      if ((pool->libs[pool->nlibs++] = dlopen (path, run_rtld ())) == NULL)
+	{
+	  fprintf (stderr, "error: %s\n", dlerror ());
+	  pool->failed++;
+	}
+      free (path);
+    }
+}
+
+/* Count in POOL the cases from the element FIRST to LAST, not
+   included, of FUNCTION which are skipped.  Returns true if the
+   function can be called by the engine.  */
+static bool
+run_skip (struct run_pool *pool, tree function,
+	  struct tree_list_element *first, struct tree_list_element *last)
+{
+  bool callable = run_function_p (function);
+  struct tree_list_element *el;
+
+  for (el = first; el != last; el = el->next)
+    pool->skipped += !callable || TREE_CODE (el->entry) != EXPECT;
+  return callable;
+}
+
+/* Split the cases of all the modules into the chunks of POOL for
+   SPLIT workers.  If LOAD is set, the libraries are loaded and the
+   functions are looked up.  Cases without expected values and
+   functions which cannot be called by the engine are skipped.  */
+static void
+run_build (struct run_pool *pool, bool load, int split)
+{
+  struct tree_list_element *tl, *tll;
+  void *lib = NULL;
+  size_t i = 0;
+
+  if (load)
+    run_load (pool);
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    {
+      if (load && (lib = pool->libs[i++]) == NULL)
+	continue;
+      DL_FOREACH (TREE_LIST (TREE_OPERAND (tl->entry, 1)), tll)
+	if (run_skip (pool, tll->entry,
+		      TREE_LIST (TREE_OPERAND (tll->entry, 1)), NULL))
+	  pool->failed += run_add_function (pool, lib, tl->entry, tll->entry,
+					    split);
+    }
+}
+
+/* Free the chunks of POOL and unload its libraries.  */
+static void
+run_free (struct run_pool *pool)
+{
+  size_t i;
+
+  for (i = 0; i < pool->nchunks; i++)
+    {
+      free (pool->chunks[i].out);
+      if (i + 1 == pool->nchunks
+	  || pool->chunks[i + 1].function != pool->chunks[i].function)
+	{
+	  free (pool->chunks[i].function->cases);
+	  free (pool->chunks[i].function);
+	}
+    }
+  free (pool->chunks);
+  for (i = 0; i < pool->nlibs; i++)
+    if (pool->libs[i] != NULL)
+      dlclose (pool->libs[i]);
+  free (pool->libs);
+}
+
+/* Print the reports of the chunks of POOL in the order of the
+   scenario and the summary of every function.  Returns non-zero if
+   a case failed.  */
+static int
+run_report (struct run_pool *pool, const char *file)
+{
+  struct run_function *fi;
+  int cases = 0, failed = pool->failed, done, bad;
+  size_t i, j;
+
+  for (i = 0; i < pool->nchunks; i = j)
+    {
+      fi = pool->chunks[i].function;
+      done = bad = 0;
+      for (j = i; j < pool->nchunks
+		  && pool->chunks[j].function->function == fi->function; j++)
+	{
+	  /* A chunk stopped after the first failure has no output.  */
+	  if (pool->chunks[j].out != NULL)
+	    fwrite (pool->chunks[j].out, 1, pool->chunks[j].size, stderr);
+	  done += pool->chunks[j].done;
+	  bad += pool->chunks[j].failed;
+	}
+      printf ("%s.%s: %i cases, %i failed\n",
+	      TREE_VALUE (TREE_OPERAND (fi->module, 0)),
+	      TREE_VALUE (TREE_OPERAND (fi->function, 0)), done, bad);
+      cases += done;
+      failed += bad;
+    }
+
+  printf ("note: %i cases of `%s' are run, %i failed.\n", cases, file,
+	  failed);
+  if (run_stop)
+    printf ("note: the run is stopped after the first failure.\n");
+  if (pool->skipped != 0)
+    printf ("note: %i cases without expected values or with unsupported "
+	    "types are skipped.\n", pool->skipped);
+  return failed != 0;
+}
+
+/* Chunks passed from a stage of a pipelined run to the next one.  A
+   stage waits while the queue is full, so that it runs at most
+   RUN_QUEUE chunks ahead of the next one.  */
+struct run_queue
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct run_chunk *items[RUN_QUEUE];
+  size_t head, count;
+  bool closed;
+};
+
+/* A pipelined run: the chunks are called from the queue CALLS and
+   checked from the queue CHECKS.  FN is the function looked up last,
+   and BASE is the number of its cases queued so far.  */
+struct run_pipeline
+{
+  struct run_pool *pool;
+  struct run_queue calls, checks;
+  tree function;
+  void *fn;
+  int base;
+};
+
+static void
+run_queue_init (struct run_queue *q)
+{
+  memset (q, 0, sizeof (struct run_queue));
+  pthread_mutex_init (&q->lock, NULL);
+  pthread_cond_init (&q->cond, NULL);
+}
+
+/* Add the chunk C to the queue Q, waiting for room.  */
+static void
+run_queue_push (struct run_queue *q, struct run_chunk *c)
+{
+  pthread_mutex_lock (&q->lock);
+  while (q->count == RUN_QUEUE)
+    pthread_cond_wait (&q->cond, &q->lock);
+  q->items[(q->head + q->count++) % RUN_QUEUE] = c;
+  pthread_cond_broadcast (&q->cond);
+  pthread_mutex_unlock (&q->lock);
+}
+
+/* Take the next chunk from the queue Q, waiting for one.  Returns NULL
+   once the queue is closed and empty.  */
+static struct run_chunk *
+run_queue_pop (struct run_queue *q)
+{
+  struct run_chunk *c = NULL;
+
+  pthread_mutex_lock (&q->lock);
+  while (q->count == 0 && !q->closed)
+    pthread_cond_wait (&q->cond, &q->lock);
+  if (q->count != 0)
+    {
+      c = q->items[q->head];
+      q->head = (q->head + 1) % RUN_QUEUE;
+      q->count--;
+      pthread_cond_broadcast (&q->cond);
+    }
+  pthread_mutex_unlock (&q->lock);
+  return c;
+}
+
+static void
+run_queue_close (struct run_queue *q)
+{
+  pthread_mutex_lock (&q->lock);
+  q->closed = true;
+  pthread_cond_broadcast (&q->cond);
+  pthread_mutex_unlock (&q->lock);
+}
+
+static void
+run_queue_destroy (struct run_queue *q)
+{
+  pthread_mutex_destroy (&q->lock);
+  pthread_cond_destroy (&q->cond);
+}
+
+/* First stage of a pipelined run, called by `bake' with the cases of
+   FUNCTION of MODULE from FIRST to LAST, not included, as soon as
+   their expected values are computed: they are queued to be
+   called.  */
+static void
+run_ready (tree module, tree function, struct tree_list_element *first,
+	   struct tree_list_element *last, void *data)
+{
+  struct run_pipeline *p = (struct run_pipeline *) data;
+  struct tree_list_element *tl;
+  struct run_chunk *c;
+  size_t i = 0;
+
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    if (tl->entry == module)
+      break;
+    else
+      i++;
+  if (p->pool->libs[i] == NULL || !run_skip (p->pool, function, first, last))
+    return;
+
+  if (function != p->function)
+    {
+      p->function = function;
+      p->base = 0;
+      p->fn = dlsym (p->pool->libs[i], TREE_VALUE (TREE_OPERAND (function, 0)));
+      if (p->fn == NULL)
+	{
+	  fprintf (stderr, "error: %s\n", dlerror ());
+	  p->pool->failed++;
+	}
+    }
+  if (p->fn == NULL)
+    return;
+
+  if ((c = calloc (1, sizeof (struct run_chunk))) == NULL)
+    err (EXIT_FAILURE, "calloc failed");
+  c->function = run_new_function (p->fn, module, function, first, last);
+  c->function->base = p->base;
+  c->hi = c->function->n;
+  p->base += c->hi;
+  run_queue_push (&p->calls, c);
+}
+
+/* Second stage of a pipelined run: the functions are called.  In an
+   isolated run the cases are also checked by the child.  */
+static void *
+run_call_stage (void *arg)
+{
+  struct run_pipeline *p = (struct run_pipeline *) arg;
+  struct run_chunk *c;
+  int i;
+
+  while ((c = run_queue_pop (&p->calls)) != NULL)
+    {
+      if (isolate)
+	run_chunk (c);
+      else if (!__atomic_load_n (&run_stop, __ATOMIC_RELAXED))
+	{
+	  if ((c->results = calloc (c->hi + 1, sizeof (union run_value)))
+	      == NULL)
+	    err (EXIT_FAILURE, "calloc failed");
+	  for (i = c->lo; i < c->hi; i++)
+	    if (run_valid_p (c->function, i, NULL))
+	      c->results[i] = run_native (c->function, i);
+	}
+      run_queue_push (&p->checks, c);
+    }
+  run_queue_close (&p->checks);
+  return NULL;
+}
+
+/* Last stage of a pipelined run: the results are checked and the
+   chunks are added to the pool in the order of the scenario.  */
+static void *
+run_check_stage (void *arg)
+{
+  struct run_pipeline *p = (struct run_pipeline *) arg;
+  struct run_chunk *c;
+  enum type_code ret;
+  FILE *out;
+  int i;
+
+  while ((c = run_queue_pop (&p->checks)) != NULL)
+    {
+      if (c->results != NULL)
+	{
+	  ret = type_lookup (TREE_VALUE (TREE_LIST (TREE_OPERAND (
+		  c->function->function, 2))->entry));
+	  if ((out = open_memstream (&c->out, &c->size)) == NULL)
+	    err (EXIT_FAILURE, "open_memstream failed");
+	  for (i = c->lo; i < c->hi; i++)
+	    {
+	      c->failed += !(run_valid_p (c->function, i, out)
+			     && run_check (c->function, i, c->results[i],
+					   out));
+	      if (ret == TYPE_STR)
+		free ((char *) c->results[i].s);
+	    }
+	  c->done = c->hi - c->lo;
+	  fclose (out);
+	  free (c->results);
+	  c->results = NULL;
+	  if (c->failed != 0 && fail_fast)
+	    __atomic_store_n (&run_stop, 1, __ATOMIC_RELAXED);
+	}
+      *run_append (p->pool, c->function, c->lo, c->hi) = *c;
+      free (c);
+    }
+  return NULL;
+}
+
+/* Compute the expected values by the prototypes while the cases with
+   known ones are called, and check the results of the calls while the
+   next cases are called.  The libraries of POOL must be loaded.
+   Returns non-zero if the prototypes failed.  */
+static int
+run_pipeline (struct run_pool *pool)
+{
+  struct run_pipeline p;
+  pthread_t calls, checks;
+  int ret;
+
+  memset (&p, 0, sizeof (p));
+  p.pool = pool;
+  run_queue_init (&p.calls);
+  run_queue_init (&p.checks);
+  if (pthread_create (&calls, NULL, run_call_stage, &p) != 0
+      || pthread_create (&checks, NULL, run_check_stage, &p) != 0)
+    errx (EXIT_FAILURE, "pthread_create failed");
+
+  ret = bake (module_list, bake_jobs, run_ready, &p);
+  run_queue_close (&p.calls);
+  pthread_join (calls, NULL);
+  pthread_join (checks, NULL);
+  run_queue_destroy (&p.calls);
+  run_queue_destroy (&p.checks);
+  return ret;
+}
+
+/* Hash of the cases of the scenario, which the coordinator and the
+   workers must agree on.  */
+static unsigned long long
+run_scenario_hash (void)
+{
+  struct tree_list_element *tl;
+  unsigned long long h = 14695981039346656037ULL;
+  char *key, *c;
+
+  /* FNV-1a.  */
+  DL_FOREACH (TREE_LIST (module_list), tl)
+    {
+      key = case_key (tl->entry);
+      for (c = key; *c != '\0'; c++)
+	h = (h ^ (unsigned char) *c) * 1099511628211ULL;
+      free (key);
+    }
+  return h;
+}
+
+/* Open the stream socket of the address ADDR, which is either
+   `unix:<path>' or `<host>:<port>'.  If LISTENING is set the socket
+   is bound to the address, otherwise it is connected.  Returns -1 on
+   error.  */
+static int
+run_socket (const char *addr, bool listening)
+{
+  struct addrinfo hints, *res, *ai;
+  struct sockaddr_un sun;
+  char *host, *port;
+  int fd = -1, one = 1;
+
+  if (strncmp (addr, "unix:", 5) == 0)
+    {
+      memset (&sun, 0, sizeof (sun));
+      sun.sun_family = AF_UNIX;
+      strncpy (sun.sun_path, addr + 5, sizeof (sun.sun_path) - 1);
+      if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) == -1)
+	return -1;
+      if (listening)
+	unlink (sun.sun_path);
+      if (listening
+	  ? bind (fd, (struct sockaddr *) &sun, sizeof (sun)) == -1
+	    || listen (fd, SOMAXCONN) == -1
+	  : connect (fd, (struct sockaddr *) &sun, sizeof (sun)) == -1)
+	{
+	  close (fd);
+	  return -1;
+	}
+      return fd;
+    }
+
+  if ((host = strdup (addr)) == NULL)
+    err (EXIT_FAILURE, "strdup failed");
+  if ((port = strrchr (host, ':')) == NULL)
+    {
+      free (host);
+      return -1;
+    }
+  *port++ = '\0';
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listening ? AI_PASSIVE : 0;
+  if (getaddrinfo (*host != '\0' ? host : NULL, port, &hints, &res) != 0)
+    {
+      free (host);
+      return -1;
+    }
+  for (ai = res; ai != NULL; ai = ai->ai_next)
+    {
+      if ((fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol))
+	  == -1)
+	continue;
+      if (listening)
+	setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+      if (listening
+	  ? bind (fd, ai->ai_addr, ai->ai_addrlen) == 0
+	    && listen (fd, SOMAXCONN) == 0
+	  : connect (fd, ai->ai_addr, ai->ai_addrlen) == 0)
+	break;
+      close (fd);
+      fd = -1;
+    }
+  freeaddrinfo (res);
+  free (host);
+  return fd;
+}
+
+/* Send LEN bytes of BUF to the socket FD.  Returns false on error.  */
+static bool
+run_send (int fd, const void *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+    {
+      if ((n = send (fd, buf, len, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return false;
+      buf = (const char *) buf + n;
+      len -= n;
+    }
+  return true;
+}
+
+/* A worker connected to the coordinator: the data received and not
+   processed yet, and the chunk leased to it or -1 and the time its
+   lease expires.  */
+struct run_client
+{
+  int fd;
+  char *buf;
+  size_t len;
+  long chunk;
+  time_t deadline;
+  bool waiting;
+};
+
+/* Chunks of the coordinator: the state of every chunk, the number of
+   times it was leased, and the chunks given back by dead workers.  */
+struct run_leases
+{
+  char *state;
+  int *count;
+  size_t *queue, nqueue, next, done, leased;
+};
+
+enum { RUN_PENDING, RUN_LEASED, RUN_DONE };
+
+/* Take a chunk to lease.  Returns -1 if no chunk is pending.  */
+static long
+run_lease (struct run_pool *pool, struct run_leases *l)
+{
+  long k = -1;
+
+  if (l->nqueue > 0)
+    k = l->queue[--l->nqueue];
+  else
+    {
+      while (l->next < pool->nchunks && l->state[l->next] != RUN_PENDING)
+	l->next++;
+      if (l->next < pool->nchunks)
+	k = l->next++;
+    }
+  if (k != -1)
+    {
+      l->state[k] = RUN_LEASED;
+      l->count[k]++;
+      l->leased++;
+    }
+  return k;
+}
+
+/* Seconds of the monotonic clock.  */
+static time_t
+run_clock (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+/* Give the chunk leased to the dead client C back.  A chunk which
+   killed RUN_LEASES workers is reported as failed.  */
+static void
+run_release (struct run_pool *pool, struct run_leases *l,
+	     struct run_client *c)
+{
+  struct run_chunk *ch;
+  FILE *out;
+
+  if (c->chunk == -1)
+    return;
+  l->leased--;
+  ch = &pool->chunks[c->chunk];
+  if (l->count[c->chunk] < RUN_LEASES)
+    {
+      l->state[c->chunk] = RUN_PENDING;
+      l->queue[l->nqueue++] = c->chunk;
+    }
+  else
+    {
+      if ((out = open_memstream (&ch->out, &ch->size)) == NULL)
+	err (EXIT_FAILURE, "open_memstream failed");
+      fprintf (out, "%s.%s: cases %i to %i: %i workers died\n",
+	       TREE_VALUE (TREE_OPERAND (ch->function->module, 0)),
+	       TREE_VALUE (TREE_OPERAND (ch->function->function, 0)),
+	       ch->lo, ch->hi - 1, RUN_LEASES);
+      fclose (out);
+      ch->done = ch->failed = ch->hi - ch->lo;
+      l->state[c->chunk] = RUN_DONE;
+      l->done++;
+    }
+  c->chunk = -1;
+}
+
+/* Process the messages received from the client C.  Returns false if
+   the client must be dropped.  */
+static bool
+run_message (struct run_pool *pool, struct run_leases *l,
+	     struct run_client *c, unsigned long long hash)
+{
+  unsigned long long h;
+  size_t k, nchunks, line;
+  int done, failed, len;
+  char *nl;
+
+  while ((nl = memchr (c->buf, '\n', c->len)) != NULL)
+    {
+      *nl = '\0';
+      line = nl - c->buf + 1;
+      if (sscanf (c->buf, "HELLO %llx %zu", &h, &nchunks) == 2)
+	{
+	  if (h != hash || nchunks != pool->nchunks)
+	    {
+	      run_send (c->fd, "ERR scenario differs\n", 21);
+	      return false;
+	    }
+	  run_send (c->fd, "OK\n", 3);
+	}
+      else if (strcmp (c->buf, "NEXT") == 0)
+	c->waiting = true;
+      else if (sscanf (c->buf, "RESULT %zu %i %i %i", &k, &done, &failed,
+		       &len) == 4)
+	{
+	  if (k >= pool->nchunks || (long) k != c->chunk || len < 0)
+	    return false;
+	  /* The report follows the line.  */
+	  if (c->len < line + len)
+	    {
+	      *nl = '\n';
+	      break;
+	    }
+	  pool->chunks[k].done = done;
+	  pool->chunks[k].failed = failed;
+	  pool->chunks[k].size = len;
+	  if ((pool->chunks[k].out = malloc (len + 1)) == NULL)
+	    err (EXIT_FAILURE, "malloc failed");
+	  memcpy (pool->chunks[k].out, nl + 1, len);
+	  line += len;
+	  l->state[k] = RUN_DONE;
+	  l->done++;
+	  l->leased--;
+	  c->chunk = -1;
+	  if (failed != 0 && fail_fast)
+	    run_stop = 1;
+	}
+      else
+	return false;
+      memmove (c->buf, c->buf + line, c->len - line);
+      c->len -= line;
+    }
+  return true;
+}
+
+/* Serve the chunks of POOL to the workers connecting to the address
+   of the coordinator until all of them are checked.  The reports of
+   the workers are stored in the chunks.  A worker whose lease expired
+   is dropped, as it may hang or be cut off.  Returns non-zero on
+   error.  */
+static int
+run_serve (struct run_pool *pool)
+{
+  struct run_leases l;
+  struct run_client *clients = NULL;
+  struct pollfd *pfd = NULL;
+  unsigned long long hash = run_scenario_hash ();
+  size_t i, j, n = 0;
+  char buf[4096], msg[64];
+  ssize_t got;
+  time_t now, wait;
+  long k;
+  int lfd, fd;
+
+  if ((lfd = run_socket (serve_addr, true)) == -1)
+    {
+      warn ("cannot listen on `%s'", serve_addr);
+      return 1;
+    }
+  memset (&l, 0, sizeof (l));
+  if ((l.state = calloc (pool->nchunks + 1, 1)) == NULL
+      || (l.count = calloc (pool->nchunks + 1, sizeof (int))) == NULL
+      || (l.queue = calloc (pool->nchunks + 1, sizeof (size_t))) == NULL)
+    err (EXIT_FAILURE, "calloc failed");
+  printf ("note: serving %zu chunks on `%s'.\n", pool->nchunks, serve_addr);
+  fflush (stdout);
+
+  while (l.done < pool->nchunks && !(run_stop && l.leased == 0))
+    {
+      if ((pfd = realloc (pfd, (n + 1) * sizeof (struct pollfd))) == NULL)
+	err (EXIT_FAILURE, "realloc failed");
+      pfd[0].fd = lfd;
+      pfd[0].events = POLLIN;
+      now = run_clock ();
+      wait = -1;
+      for (i = 0; i < n; i++)
+	{
+	  pfd[i + 1].fd = clients[i].fd;
+	  pfd[i + 1].events = POLLIN;
+	  if (clients[i].chunk != -1
+	      && (wait == -1 || clients[i].deadline - now < wait))
+	    wait = clients[i].deadline > now ? clients[i].deadline - now : 0;
+	}
+      if (poll (pfd, n + 1, wait == -1 ? -1 : (int) wait * 1000 + 1) == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  err (EXIT_FAILURE, "poll failed");
+	}
+      now = run_clock ();
+
+      for (i = 0, j = 0; i < n; i++)
+	{
+	  bool alive = true;
+
+	  if (pfd[i + 1].revents != 0)
+	    {
+	      got = read (clients[i].fd, buf, sizeof (buf));
+	      if (got <= 0)
+		alive = false;
+	      else
+		{
+		  clients[i].buf = realloc (clients[i].buf,
+					    clients[i].len + got + 1);
+		  if (clients[i].buf == NULL)
+		    err (EXIT_FAILURE, "realloc failed");
+		  memcpy (clients[i].buf + clients[i].len, buf, got);
+		  clients[i].len += got;
+		  alive = run_message (pool, &l, &clients[i], hash);
+		}
+	    }
+	  if (alive && clients[i].chunk != -1 && now >= clients[i].deadline)
+	    {
+	      warnx ("lease of chunk %ld expired after %li s",
+		     clients[i].chunk, lease_time);
+	      alive = false;
+	    }
+	  if (!alive)
+	    {
+	      run_release (pool, &l, &clients[i]);
+	      close (clients[i].fd);
+	      free (clients[i].buf);
+	      continue;
+	    }
+	  clients[j++] = clients[i];
+	}
+      n = j;
+
+      /* Workers which asked for a chunk get one, or are told to stop
+	 if the run is stopped.  Otherwise they wait, as a leased chunk
+	 may be given back.  */
+      for (i = 0; i < n; i++)
+	if (clients[i].waiting)
+	  {
+	    if (!run_stop && (k = run_lease (pool, &l)) != -1)
+	      {
+		clients[i].chunk = k;
+		clients[i].deadline = now + lease_time;
+		snprintf (msg, sizeof (msg), "CHUNK %ld\n", k);
+	      }
+	    else if (run_stop)
+	      snprintf (msg, sizeof (msg), "DONE\n");
+	    else
+	      continue;
+	    clients[i].waiting = false;
+	    run_send (clients[i].fd, msg, strlen (msg));
+	  }
+
+      if (pfd[0].revents != 0 && (fd = accept (lfd, NULL, NULL)) != -1)
+	{
+	  clients = realloc (clients, (n + 1) * sizeof (struct run_client));
+	  if (clients == NULL)
+	    err (EXIT_FAILURE, "realloc failed");
+	  memset (&clients[n], 0, sizeof (struct run_client));
+	  clients[n].fd = fd;
+	  clients[n++].chunk = -1;
+	}
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      run_send (clients[i].fd, "DONE\n", 5);
+      close (clients[i].fd);
+      free (clients[i].buf);
+    }
+  close (lfd);
+  if (strncmp (serve_addr, "unix:", 5) == 0)
+    unlink (serve_addr + 5);
+  free (clients);
+  free (pfd);
+  free (l.state);
+  free (l.count);
+  free (l.queue);
+  return 0;
+}
+
+/* Check the chunks leased by the coordinator until it has no more.
+   Returns non-zero on error.  */
+static int
+run_work (struct run_pool *pool)
+{
+  char *line = NULL, head[96];
+  size_t size = 0, k, chunks = 0;
+  struct run_chunk *c;
+  int fd, ret = 0;
+  bool done = false;
+  FILE *in;
+
+  if ((fd = run_socket (connect_addr, false)) == -1)
+    {
+      warn ("cannot connect to `%s'", connect_addr);
+      return 1;
+    }
+  if ((in = fdopen (dup (fd), "r")) == NULL)
+    err (EXIT_FAILURE, "fdopen failed");
+
+  snprintf (head, sizeof (head), "HELLO %llx %zu\n", run_scenario_hash (),
+	    pool->nchunks);
+  /* A coordinator which has no chunks left answers DONE, or has
+     closed the connection already.  */
+  if (!run_send (fd, head, strlen (head))
+      || getline (&line, &size, in) == -1 || strcmp (line, "DONE\n") == 0)
+    done = true;
+  else if (strcmp (line, "OK\n") != 0)
+    {
+      fprintf (stderr, "error: coordinator `%s' refused the worker: %s",
+	       connect_addr, line != NULL ? line : "no answer\n");
+      ret = 1;
+    }
+
+  while (ret == 0 && !done && run_send (fd, "NEXT\n", 5)
+	 && getline (&line, &size, in) != -1
+	 && sscanf (line, "CHUNK %zu", &k) == 1 && k < pool->nchunks)
+    {
+      c = &pool->chunks[k];
+      run_chunk (c);
+      snprintf (head, sizeof (head), "RESULT %zu %i %i %zu\n", k, c->done,
+		c->failed, c->size);
+      if (!run_send (fd, head, strlen (head))
+	  || !run_send (fd, c->out, c->size))
+	break;
+      chunks++;
+    }
+
+  printf ("note: %zu chunks checked for `%s'.\n", chunks, connect_addr);
+  free (line);
+  fclose (in);
+  close (fd);
+  return ret;
+}
+
+/* Check every batch of cases in a child process with the limits
+   TIMEOUT in milliseconds, unless it is 0, and MEMORY in megabytes.  */
+void
+run_isolate (long timeout, long memory)
+{
+  isolate = true;
+  if (timeout > 0)
+    run_timeout = timeout;
+  run_memory = memory;
+}
+
+/* Check the cases by JOBS workers, or by one per processor if JOBS is
+   0.  If FAST is set, the run stops after the first failed chunk.  */
+void
+run_parallel (int jobs, bool fast)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  run_jobs = jobs > 0 ? jobs : n > 0 ? n : 1;
+  fail_fast = fast;
+}
+
+/* Serve the cases to the workers connecting to SERVE, or check the
+   cases leased by the coordinator at CONNECT.  A worker must check a
+   chunk in LEASE seconds, unless it is 0.  */
+void
+run_remote (const char *serve, const char *connect, long lease)
+{
+  serve_addr = serve;
+  connect_addr = connect;
+  if (lease > 0)
+    lease_time = lease;
+}
+
+/* Compute the expected values by JOBS workers of the prototypes, or
+   by one per processor if JOBS is 0, while the cases are run.  */
+void
+run_bake (int jobs)
+{
+  bake_jobs = jobs;
+}
+
+/* Run the cases with expected values of all the modules, loading
+   `./lib<module>.so'.  The reports of the cases are printed in the
+   order of the scenario whatever the number of workers.  Returns
+   non-zero if a case failed.  */
+int
+run (char *file)
+{
+  struct run_pool pool;
+  int ret = 0;
+
+  memset (&pool, 0, sizeof (pool));
+  pool.workers = run_jobs;
+  /* The coordinator and the workers split all the cases at once.  */
+  if (bake_jobs >= 0 && serve_addr == NULL && connect_addr == NULL)
+    {
+      run_load (&pool);
+      ret = run_pipeline (&pool);
+      ret |= run_report (&pool, file);
+      run_free (&pool);
+      return ret;
+    }
+  if (bake_jobs >= 0 && bake (module_list, bake_jobs, NULL, NULL) != 0)
+    return 1;
+
+  if (serve_addr != NULL)
+    {
+      run_build (&pool, false, RUN_REMOTE_WORKERS);
+      ret = run_serve (&pool);
+      ret |= run_report (&pool, file);
+    }
+  else if (connect_addr != NULL)
+    {
+      run_build (&pool, true, RUN_REMOTE_WORKERS);
+      ret = pool.failed != 0 || run_work (&pool);
+    }
+  else
+    {
+      run_build (&pool, true, run_jobs);
+      run_pool (&pool);
+      ret = run_report (&pool, file);
+    }
+  run_free (&pool);
+  return ret;
+}
@@ -0,0 +1,359 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+/* Partition of the cases of a scenario into shards of similar cost.
+   The cost of a case is the number of calls it makes, multiplied by
+   the time of one call of the function if it was measured by a
+   previous run.  Cases with ranges which cost more than a shard are
+   split into pieces, then the units are assigned to the shards in
+   the order of decreasing cost, each one to the shard with the least
+   cost so far.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <sys/stat.h>
+
+#include "pipo.h"
+#include "types.h"
+#include "shard.h"
+
+/* Cost of a case streamed from a file, per byte of the file, and of
+   a case produced by a generator, which cannot be estimated.  */
+#define FILE_BYTES_PER_CASE 16
+#define GENERATOR_CASES 1000
+
+/* Set LAST to the number of the last value of the range T, and
+   return false if the range is empty.  A range of 64-bit integers
+   may have 2^64 values, so the values are counted from 0, and the
+   distance between the bounds, which may not fit in a signed
+   integer, is unsigned.  */
+static bool
+range_last (tree t, unsigned long long *last)
+{
+  long long start = strtoll (TREE_VALUE (TREE_OPERAND (t, 0)), NULL, 0);
+  long long end = strtoll (TREE_VALUE (TREE_OPERAND (t, 1)), NULL, 0);
+  long long step = strtoll (TREE_VALUE (TREE_OPERAND (t, 2)), NULL, 0);
+
+  if (end < start)
+    return false;
+  *last = ((unsigned long long) end - (unsigned long long) start)
+	  / (unsigned long long) step;
+  return true;
+}
+
+/* Number of the first value of the piece P when the LAST + 1 values
+   of a range are split into PIECES.  It is computed modulo 2^64,
+   which is exact for every piece and wraps only past the last
+   one.  */
+static unsigned long long
+range_split (unsigned long long last, long long pieces, long long p)
+{
+  return last / pieces * p + (last % pieces + 1) * p / pieces;
+}
+
+/* Value number K of the range starting at START by STEP, which may
+   be past the signed limits on the way.  */
+static long long
+range_value (long long start, long long step, unsigned long long k)
+{
+  return (long long) ((unsigned long long) start
+		      + (unsigned long long) step * k);
+}
+
+/* Number of calls made by the case T.  Random arguments of a case
+   are drawn together, so their count is taken once.  */
+static double
+case_calls (tree t)
+{
+  struct tree_list_element *el;
+  unsigned long long last;
+  struct stat st;
+  double n = 1;
+  bool random = false;
+  char *path;
+
+  switch (TREE_CODE (t))
+    {
+    case FILE_CASES:
+      /* The path is kept with the quotes.  */
+      path = strndup (TREE_VALUE (TREE_OPERAND (t, 0)) + 1,
+		      strlen (TREE_VALUE (TREE_OPERAND (t, 0))) - 2);
+      if (stat (path, &st) == 0)
+	n = st.st_size / FILE_BYTES_PER_CASE;
+      free (path);
+      return n > 1 ? n : 1;
+    case GENERATOR:
+      return GENERATOR_CASES;
+    case LIST:
+      DL_FOREACH (TREE_LIST (t), el)
+	if (TREE_CODE (el->entry) == RANGE)
+	  n *= range_last (el->entry, &last) ? (double) last + 1 : 0;
+	else if (TREE_CODE (el->entry) == RANDOM && !random)
+	  {
+	    n *= strtod (TREE_VALUE (TREE_OPERAND (el->entry, 1)), NULL);
+	    random = true;
+	  }
+      return n;
+    default:
+      return 1;
+    }
+}
+
+struct timing
+{
+  char *name;
+  double seconds, calls;
+};
+
+/* Read the times measured by a previous run from the file PATH.
+   Every line is `<module>.<function> <seconds> <calls>'; lines of one
+   function are summed.  */
+static struct timing *
+read_times (const char *path, size_t *n)
+{
+  struct timing *t = NULL;
+  char name[256];
+  double seconds, calls;
+  size_t i, size = 0;
+  FILE *f;
+
+  *n = 0;
+  if ((f = fopen (path, "r")) == NULL)
+    {
+      warn ("cannot read times from `%s'", path);
+      return NULL;
+    }
+  while (fscanf (f, "%255s %lf %lf", name, &seconds, &calls) == 3)
+    {
+      for (i = 0; i < *n; i++)
+	if (strcmp (t[i].name, name) == 0)
+	  break;
+      if (i == *n)
+	{
+	  if (*n == size)
+	    {
+	      size = size == 0 ? 16 : size * 2;
+	      if ((t = realloc (t, size * sizeof (struct timing))) == NULL)
+		err (EXIT_FAILURE, "realloc failed");
+	    }
+	  t[i].name = strdup (name);
+	  t[i].seconds = t[i].calls = 0;
+	  (*n)++;
+	}
+      t[i].seconds += seconds;
+      t[i].calls += calls;
+    }
+  fclose (f);
+  return t;
+}
+
+/* Time of one call of FUNCTION of MODULE according to TIMES.  If it
+   was not measured, the mean time of a call of the other functions
+   is used, or 1 if nothing was measured.  */
+static double
+call_time (struct timing *times, size_t n, tree module, tree function)
+{
+  char *name = NULL;
+  double ret = 1, seconds = 0, calls = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    {
+      seconds += times[i].seconds;
+      calls += times[i].calls;
+    }
+  if (calls > 0 && seconds > 0)
+    ret = seconds / calls;
+
+  if (-1 == asprintf (&name, "%s.%s", TREE_VALUE (TREE_OPERAND (module, 0)),
+		      TREE_VALUE (TREE_OPERAND (function, 0))))
+    err (EXIT_FAILURE, "asprintf failed");
+  for (i = 0; i < n; i++)
+    if (strcmp (times[i].name, name) == 0 && times[i].calls > 0)
+      ret = times[i].seconds / times[i].calls;
+  free (name);
+  return ret;
+}
+
+static int
+unit_cost_cmp (const void *a, const void *b)
+{
+  const struct shard_unit *x = a, *y = b;
+  return x->cost < y->cost ? 1 : x->cost > y->cost ? -1 : 0;
+}
+
+static int
+unit_args_cmp (const void *a, const void *b)
+{
+  const struct shard_unit *x = a, *y = b;
+
+  if (x->args != y->args)
+    return x->args < y->args ? -1 : 1;
+  return x->shard - y->shard;
+}
+
+/* Split the cases of the modules MODULES among N shards.  TIMES is
+   the file with the times measured by a previous run, or NULL.
+   Returns the array of the units sorted by cases and shards, its
+   length is stored in COUNT.  */
+struct shard_unit *
+shard_plan (tree modules, int n, const char *times, size_t *count)
+{
+  struct tree_list_element *tl, *tll, *tlll, *el;
+  struct shard_unit *units = NULL;
+  struct timing *timing = NULL;
+  size_t i, j, size = 0, ntimes = 0;
+  double total = 0, *load;
+  int k, best;
+
+  if (times != NULL)
+    timing = read_times (times, &ntimes);
+
+  /* Every case is one unit at first.  */
+  *count = 0;
+  DL_FOREACH (TREE_LIST (modules), tl)
+    DL_FOREACH (TREE_LIST (TREE_OPERAND (tl->entry, 1)), tll)
+      {
+	double t = call_time (timing, ntimes, tl->entry, tll->entry);
+
+	DL_FOREACH (TREE_LIST (TREE_OPERAND (tll->entry, 1)), tlll)
+	  {
+	    if (*count == size)
+	      {
+		size = size == 0 ? 64 : size * 2;
+		units = realloc (units, size * sizeof (struct shard_unit));
+		if (units == NULL)
+		  err (EXIT_FAILURE, "realloc failed");
+	      }
+	    units[*count].module = tl->entry;
+	    units[*count].function = tll->entry;
+	    units[*count].args = tlll->entry;
+	    units[*count].range = NULL;
+	    units[*count].calls = case_calls (tlll->entry);
+	    units[*count].cost = units[*count].calls * t;
+	    units[*count].shard = -1;
+	    total += units[(*count)++].cost;
+	  }
+      }
+
+  /* Cases with ranges that cost more than a shard are split by the
+     values of the first range into at most N pieces.  */
+  for (i = 0, j = *count; i < j; i++)
+    {
+      tree range = NULL;
+      unsigned long long last, k0, k1;
+      long long pieces, start, step, p;
+      double cost = units[i].cost, calls = units[i].calls;
+
+      if (TREE_CODE (units[i].args) != LIST || cost <= total / n)
+	continue;
+      DL_FOREACH (TREE_LIST (units[i].args), el)
+	if (TREE_CODE (el->entry) == RANGE)
+	  {
+	    range = el->entry;
+	    break;
+	  }
+      if (range == NULL || !range_last (range, &last) || last == 0)
+	continue;
+
+      pieces = (long long) (cost / (total / n)) + 1;
+      pieces = pieces > n ? n
+	       : (unsigned long long) pieces > last ? (long long) last + 1
+	       : pieces;
+      start = strtoll (TREE_VALUE (TREE_OPERAND (range, 0)), NULL, 0);
+      step = strtoll (TREE_VALUE (TREE_OPERAND (range, 2)), NULL, 0);
+      for (p = 0; p < pieces; p++)
+	{
+	  struct shard_unit *u;
+
+	  if (p == 0)
+	    u = &units[i];
+	  else
+	    {
+	      if (*count == size)
+		{
+		  size *= 2;
+		  units = realloc (units, size * sizeof (struct shard_unit));
+		  if (units == NULL)
+		    err (EXIT_FAILURE, "realloc failed");
+		}
+	      units[*count] = units[i];
+	      u = &units[(*count)++];
+	    }
+	  k0 = range_split (last, pieces, p);
+	  k1 = range_split (last, pieces, p + 1) - 1;
+	  u->range = range;
+	  u->lo = range_value (start, step, k0);
+	  u->hi = range_value (start, step, k1);
+	  u->calls = calls * ((double) (k1 - k0) + 1) / ((double) last + 1);
+	  u->cost = cost * u->calls / calls;
+	}
+    }
+
+  /* Greedy assignment, pieces of one case go to different shards.  */
+  qsort (units, *count, sizeof (struct shard_unit), unit_cost_cmp);
+  if ((load = calloc (n, sizeof (double))) == NULL)
+    err (EXIT_FAILURE, "calloc failed");
+  for (i = 0; i < *count; i++)
+    {
+      best = -1;
+      for (k = 0; k < n; k++)
+	{
+	  if (best != -1 && load[k] >= load[best])
+	    continue;
+	  for (j = 0; units[i].range != NULL && j < i; j++)
+	    if (units[j].args == units[i].args && units[j].shard == k)
+	      break;
+	  if (units[i].range == NULL || j == i)
+	    best = k;
+	}
+      units[i].shard = best;
+      load[best] += units[i].cost;
+    }
+  free (load);
+
+  qsort (units, *count, sizeof (struct shard_unit), unit_args_cmp);
+  for (i = 0; i < ntimes; i++)
+    free (timing[i].name);
+  free (timing);
+  return units;
+}
+
+/* Find the unit of the case ARGS assigned to the shard SHARD.  */
+struct shard_unit *
+shard_lookup (struct shard_unit *units, size_t n, tree args, int shard)
+{
+  struct shard_unit key;
+
+  key.args = args;
+  key.shard = shard;
+  return bsearch (&key, units, n, sizeof (struct shard_unit),
+		  unit_args_cmp);
+}
+
+/* Total cost of the units of the shard SHARD.  */
+double
+shard_cost (struct shard_unit *units, size_t n, int shard)
+{
+  double cost = 0;
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    if (units[i].shard == shard)
+      cost += units[i].cost;
+  return cost;
+}
@@ -0,0 +1,42 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+#include <stddef.h>
+#include "tree.h"
+
+/* Part of the work assigned to one shard: a case of a function, or
+   a piece of the values of the first range of the case.  */
+struct shard_unit
+{
+  tree module, function, args;
+
+  /* The first range of ARGS and the bounds of the piece, if the
+     case is split.  */
+  tree range;
+  long long lo, hi;
+
+  /* Number of calls and estimated cost of the unit.  */
+  double calls, cost;
+  int shard;
+};
+
+struct shard_unit *shard_plan (tree, int, const char *, size_t *);
+struct shard_unit *shard_lookup (struct shard_unit *, size_t, tree, int);
+double shard_cost (struct shard_unit *, size_t, int);
+
+#endif /* __SHARD_H__ */
@@ -175,6 +175,18 @@ free_tree (tree node)
       case MODULE:
 	{
 
+	}
+	break;
+      case RANGE:
+      case RANDOM:
+      case FILE_CASES:
+      case GENERATOR:
+      case BLOB:
+      case ARRAY:
+      case OUTBUF:
+      case EXPECT:
+	{
+
 	}
 	break;
       default:
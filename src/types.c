@@ -0,0 +1,128 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#include "types.h"
+
+#define DEF_TYPE(code, name, ctypes, ctype, size, cls) \
+  { name, ctypes, ctype, size, cls },
+#define DEF_TYPE_ALIAS(name, code)
+const struct type_info type_info[] = {
+#include "types.def"
+};
+#undef DEF_TYPE
+#undef DEF_TYPE_ALIAS
+
+struct type_alias
+{
+  const char *name;
+  enum type_code code;
+};
+
+#define DEF_TYPE(code, name, ctypes, ctype, size, cls)
+#define DEF_TYPE_ALIAS(name, code) { name, TYPE_ ## code },
+static const struct type_alias type_aliases[] = {
+#include "types.def"
+};
+#undef DEF_TYPE
+#undef DEF_TYPE_ALIAS
+
+/* Find the type by its name or alias.  Returns TYPE_MAX if
+   there is no such type.  */
+enum type_code
+type_lookup (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < TYPE_MAX; i++)
+    if (strcmp (name, TYPE_NAME (i)) == 0)
+      return (enum type_code) i;
+
+  for (i = 0; i < sizeof (type_aliases) / sizeof (type_aliases[0]); i++)
+    if (strcmp (name, type_aliases[i].name) == 0)
+      return type_aliases[i].code;
+
+  return TYPE_MAX;
+}
+
+/* Allocate string representations of the smallest and the largest
+   values of the type CODE in *MIN and *MAX.  Real types are given
+   the range [0, 1).  */
+void
+type_bounds (enum type_code code, char **min, char **max)
+{
+  unsigned long long half = 1ULL << (8 * TYPE_SIZE (code) - 1);
+  int ret;
+
+  switch (TYPE_CLASS (code))
+    {
+    case type_signed:
+      ret = asprintf (min, "%lld", -(long long) (half - 1) - 1);
+      if (ret != -1)
+	ret = asprintf (max, "%lld", (long long) (half - 1));
+      break;
+    case type_unsigned:
+      ret = asprintf (min, "0");
+      if (ret != -1)
+	ret = asprintf (max, "%llu", half - 1 + half);
+      break;
+    default:
+      ret = asprintf (min, "0.0");
+      if (ret != -1)
+	ret = asprintf (max, "1.0");
+    }
+
+  if (ret == -1)
+    err (EXIT_FAILURE, "asprintf failed");
+}
+
+/* Check if the literal VAL is a value of the type CODE: an integer
+   in the range of an integer type, a number for a real type or a
+   string for a string.  */
+bool
+type_value_p (enum type_code code, const char *val)
+{
+  unsigned long long half, u;
+  long long i;
+  char *end;
+
+  if (val[0] == '"')
+    return code == TYPE_STR;
+
+  errno = 0;
+  switch (code == TYPE_MAX ? type_void : TYPE_CLASS (code))
+    {
+    case type_signed:
+      half = 1ULL << (8 * TYPE_SIZE (code) - 1);
+      i = strtoll (val, &end, 0);
+      return *end == '\0' && errno != ERANGE
+	     && i >= -(long long) (half - 1) - 1 && i <= (long long) (half - 1);
+    case type_unsigned:
+      /* A negative value would be wrapped by strtoull.  */
+      half = 1ULL << (8 * TYPE_SIZE (code) - 1);
+      u = strtoull (val, &end, 0);
+      return *end == '\0' && errno != ERANGE
+	     && (val[0] != '-' || u == 0) && u <= half - 1 + half;
+    case type_real:
+      strtod (val, &end);
+      return *end == '\0';
+    default:
+      return false;
+    }
+}
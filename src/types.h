@@ -0,0 +1,64 @@
+/* Copyright (c) 2013 Pavel Zaichenkov <zaichenkov@gmail.com>
+
+   Permission to use, copy, modify, and distribute this software for any
+   purpose with or without fee is hereby granted, provided that the above
+   copyright notice and this permission notice appear in all copies.
+  
+   THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+   WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+   MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+   ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+   WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+   ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.  */
+
+#ifndef __TYPES_H__
+#define __TYPES_H__
+
+#include "pipo.h"
+
+enum type_class
+{
+  type_signed,
+  type_unsigned,
+  type_real,
+  type_pointer,
+  type_void
+};
+
+#define DEF_TYPE(code, name, ctypes, ctype, size, cls) TYPE_ ## code,
+#define DEF_TYPE_ALIAS(name, code)
+enum type_code
+{
+#include "types.def"
+  TYPE_MAX
+};
+#undef DEF_TYPE
+#undef DEF_TYPE_ALIAS
+
+struct type_info
+{
+  const char *name;
+  const char *ctypes;
+  const char *ctype;
+  size_t size;
+  enum type_class cls;
+};
+
+extern const struct type_info type_info[];
+
+#define TYPE_NAME(code)   type_info[(int) (code)].name
+#define TYPE_CTYPES(code) type_info[(int) (code)].ctypes
+#define TYPE_CTYPE(code)  type_info[(int) (code)].ctype
+#define TYPE_SIZE(code)   type_info[(int) (code)].size
+#define TYPE_CLASS(code)  type_info[(int) (code)].cls
+
+/* Types which can be used for generated values and arrays.  */
+#define TYPE_IS_NUMBER(code) \
+  ((code) != TYPE_MAX && TYPE_CLASS (code) <= type_real)
+
+enum type_code type_lookup (const char *);
+void type_bounds (enum type_code, char **, char **);
+bool type_value_p (enum type_code, const char *);
+
+#endif /* __TYPES_H__  */